@@ -0,0 +1,232 @@
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "access_log.h"
+
+namespace httpserver {
+
+std::atomic<int> access_log::level{ACCESS_LOG_OFF};
+
+static std::atomic<std::uint64_t> next_log_id{1};
+
+static const auto flush_interval = std::chrono::milliseconds(100);
+
+access_log::access_log(const char* path, int level, unsigned int sample, std::size_t ring_size)
+    :id_(next_log_id++),
+    sample_(sample > 1 ? sample : 1),
+    ring_size_(ring_size)
+{
+    if(std::strcmp(path, "-") == 0){
+        fd_ = STDOUT_FILENO;
+    } else {
+        fd_ = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        own_fd_ = true;
+        if(fd_ < 0){
+            std::cerr << "access log: " << path << ": " << std::strerror(errno) << "\n";
+            return;
+        }
+    }
+
+    access_log::level = level;
+    writer_ = std::thread([this]{ write_batches(); });
+}
+
+access_log::~access_log(){
+    stop();
+    if(own_fd_ && fd_ >= 0)
+        ::close(fd_);
+}
+
+bool
+access_log::wanted(unsigned int status){
+
+    int current = level.load(std::memory_order_relaxed);
+
+    if(current == ACCESS_LOG_OFF || fd_ < 0)
+        return false;
+
+    if(status >= 400)
+        return true;
+
+    if(current != ACCESS_LOG_ALL)
+        return false;
+
+    thread_local unsigned int seen = 0;
+    return ++seen % sample_ == 0;
+}
+
+access_log::ring&
+access_log::local(){
+
+    // a thread may outlive a log, rings are found by log id
+    thread_local std::uint64_t cached_id = 0;
+    thread_local ring* cached = NULL;
+
+    if(cached_id == id_)
+        return *cached;
+
+    std::size_t size = 1;
+    while(size < ring_size_)
+        size <<= 1;
+
+    std::unique_ptr<ring> r(new ring);
+    r->records.reset(new access_record[size]);
+    r->mask = size - 1;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    rings_.push_back(std::move(r));
+    cached_id = id_;
+    cached = rings_.back().get();
+    return *cached;
+}
+
+void
+access_log::append(const access_record& record){
+
+    ring& r = local();
+    std::size_t tail = r.tail.load(std::memory_order_relaxed);
+
+    if(tail - r.head.load(std::memory_order_acquire) > r.mask){
+        r.dropped.store(r.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    r.records[tail & r.mask] = record;
+    r.tail.store(tail + 1, std::memory_order_release);
+}
+
+void
+access_log::stop(){
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    wakeup_.notify_all();
+
+    if(writer_.joinable())
+        writer_.join();
+}
+
+void
+access_log::write_batches(){
+
+    std::string batch;
+    bool stopping = false;
+
+    while(!stopping){
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wakeup_.wait_for(lock, flush_interval, [this]{ return stopped_; });
+            stopping = stopped_;
+        }
+
+        batch.clear();
+        drain(batch);
+
+        std::size_t written = 0;
+        while(written < batch.size()){
+            ssize_t n = ::write(fd_, batch.data() + written, batch.size() - written);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                break;
+            written += n;
+        }
+    }
+
+    if(dropped_ > 0)
+        std::cout << "access log dropped " << dropped_ << " records, ring full" << std::endl;
+}
+
+// Runs on the writer thread, the rings vector only grows under the mutex
+std::size_t
+access_log::drain(std::string& out){
+
+    std::vector<ring*> rings;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(auto& r : rings_)
+            rings.push_back(r.get());
+    }
+
+    std::size_t count = 0;
+    std::uint64_t dropped = 0;
+
+    for(ring* r : rings){
+        std::size_t head = r->head.load(std::memory_order_relaxed);
+        std::size_t tail = r->tail.load(std::memory_order_acquire);
+
+        for(; head != tail; head++, count++)
+            format(r->records[head & r->mask], out);
+
+        r->head.store(head, std::memory_order_release);
+        dropped += r->dropped.load(std::memory_order_relaxed);
+    }
+
+    dropped_ = dropped;
+    return count;
+}
+
+void
+append_json_escaped(std::string& out, const char* s, std::size_t size){
+    for(std::size_t i = 0; i < size; i++){
+        unsigned char c = s[i];
+        if(c == '"' || c == '\\'){
+            out.push_back('\\');
+            out.push_back(c);
+        } else if(c < 0x20 || c >= 0x7f){
+            char hex[8];
+            std::snprintf(hex, sizeof(hex), "\\u%04x", c);
+            out += hex;
+        } else {
+            out.push_back(c);
+        }
+    }
+}
+
+void
+access_log::format(const access_record& record, std::string& out){
+
+    // one gmtime per second of log, not per record
+    thread_local std::time_t last_second = -1;
+    thread_local char second[32];
+
+    std::time_t now = record.time_us / 1000000;
+    if(now != last_second){
+        std::tm tm;
+        gmtime_r(&now, &tm);
+        std::strftime(second, sizeof(second), "%Y-%m-%dT%H:%M:%S", &tm);
+        last_second = now;
+    }
+
+    char client[64];
+    if(address_format(&record.client, client, sizeof(client)) < 0)
+        client[0] = '\0';
+
+    auto verb = boost::beast::http::to_string(record.verb);
+    char line[256];
+
+    std::snprintf(line, sizeof(line), "{\"time\":\"%s.%06dZ\",\"client\":\"%s\",\"verb\":\"%.*s\",\"target\":\"",
+                  second, static_cast<int>(record.time_us % 1000000), client,
+                  static_cast<int>(verb.size()), verb.data());
+    out += line;
+
+    append_json_escaped(out, record.target, record.target_size);
+
+    std::snprintf(line, sizeof(line), "\",\"status\":%u,\"bytes_in\":%llu,\"bytes_out\":%llu,\"duration_us\":%u}\n",
+                  record.status,
+                  static_cast<unsigned long long>(record.bytes_in),
+                  static_cast<unsigned long long>(record.bytes_out),
+                  record.duration_us);
+    out += line;
+}
+
+}
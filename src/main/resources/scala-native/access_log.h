@@ -0,0 +1,105 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/beast/http/verb.hpp>
+
+#include "beast_server.h"
+
+namespace httpserver {
+
+// One request as logged, copied as is into a ring, formatted later
+struct access_record {
+    std::int64_t time_us;           // system clock, when the response was sent
+    std::uint32_t duration_us;      // from the first byte of the request
+    std::uint16_t status;
+    boost::beast::http::verb verb;
+    std::uint8_t target_size;
+    std::uint64_t bytes_in;
+    std::uint64_t bytes_out;
+    address_t client;
+    char target[96];                // truncated
+};
+
+// Appends s to out as the inside of a JSON string
+void
+append_json_escaped(std::string& out, const char* s, std::size_t size);
+
+// Structured access log. Each io thread appends fixed-size records to a
+// single-producer ring of its own, a background thread drains the rings
+// every flush interval, formats the records as JSON lines and writes each
+// batch with one write(). A full ring drops records and counts them, the
+// request path never blocks or allocates.
+class access_log {
+
+public:
+
+    access_log(const char* path, int level, unsigned int sample, std::size_t ring_size);
+
+    ~access_log();
+
+    access_log(const access_log&) = delete;
+    access_log& operator=(const access_log&) = delete;
+
+    // ACCESS_LOG_ level, may be switched at any time by access_log_level
+    static std::atomic<int> level;
+
+    // Whether a response with status is logged, decided before the record
+    // is filled in: errors by level, the others by level and sampling
+    bool
+    wanted(unsigned int status);
+
+    void
+    append(const access_record& record);
+
+    // Writes what is still in the rings and joins the writer
+    void
+    stop();
+
+private:
+
+    struct alignas(64) ring {
+        std::unique_ptr<access_record[]> records;
+        std::size_t mask = 0;
+        alignas(64) std::atomic<std::size_t> head{0};
+        alignas(64) std::atomic<std::size_t> tail{0};
+        std::atomic<std::uint64_t> dropped{0};
+    };
+
+    ring&
+    local();
+
+    void
+    write_batches();
+
+    std::size_t
+    drain(std::string& out);
+
+    static void
+    format(const access_record& record, std::string& out);
+
+    const std::uint64_t id_;
+    const unsigned int sample_;
+    const std::size_t ring_size_;
+    int fd_ = -1;
+    bool own_fd_ = false;
+    std::uint64_t dropped_ = 0;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stopped_ = false;
+    std::vector<std::unique_ptr<ring>> rings_;
+    std::thread writer_;
+};
+
+}
+
+#endif // ACCESS_LOG_H
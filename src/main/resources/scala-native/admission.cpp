@@ -0,0 +1,72 @@
+
+#include "admission.h"
+#include "beast_server.h"
+
+namespace httpserver {
+
+admission_control::admission_control(unsigned int target_ms, unsigned int interval_ms)
+    :target_us_(target_ms * std::int64_t(1000)),
+    interval_us_(interval_ms * std::int64_t(1000)),
+    interval_end_(now_us() + interval_ms * std::int64_t(1000))
+{
+}
+
+bool
+admission_control::admit(int priority){
+
+    if(priority == PRIORITY_HIGH)
+        return true;
+
+    std::int64_t now = now_us();
+    if(now >= interval_end_.load(std::memory_order_relaxed))
+        next_interval(now);
+
+    if(priority == PRIORITY_LOW)
+        return !overloaded();
+
+    return !overloaded()
+        || last_sojourn_us_.load(std::memory_order_relaxed) <= 2 * target_us_;
+}
+
+bool
+admission_control::started(clock::duration sojourn, int priority){
+
+    if(priority == PRIORITY_HIGH)
+        return true;
+
+    std::int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(sojourn).count();
+    std::int64_t now = now_us();
+
+    if(now >= interval_end_.load(std::memory_order_relaxed))
+        next_interval(now);
+
+    last_sojourn_us_.store(us, std::memory_order_relaxed);
+
+    std::int64_t min = min_sojourn_us_.load(std::memory_order_relaxed);
+    while((min < 0 || us < min)
+          && !min_sojourn_us_.compare_exchange_weak(min, us, std::memory_order_relaxed))
+        ;
+
+    if(priority == PRIORITY_LOW)
+        return !overloaded() || us <= target_us_;
+
+    return !overloaded() || us <= 2 * target_us_;
+}
+
+void
+admission_control::next_interval(std::int64_t now){
+
+    std::int64_t end = interval_end_.load(std::memory_order_relaxed);
+
+    // one thread closes the interval, the others keep the old state
+    if(now < end || !interval_end_.compare_exchange_strong(end, now + interval_us_))
+        return;
+
+    // no request started, nothing queued long enough to tell
+    std::int64_t min = min_sojourn_us_.exchange(-1, std::memory_order_relaxed);
+    overloaded_.store(min > target_us_, std::memory_order_relaxed);
+    if(min < 0)
+        last_sojourn_us_.store(0, std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,62 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace httpserver {
+
+// CoDel applied to admission instead of packets. Requests waiting for a
+// worker or fiber report how long they queued; when even the shortest wait
+// of an interval stays above target the queue is standing rather than
+// absorbing a burst. While it is, requests that queued longer than twice
+// the target are shed before their handler runs, and new requests are
+// refused as long as the last one waited that long. Low priority requests
+// go as soon as the queue stands, high priority ones are never shed and do
+// not count, they skip the queue.
+class admission_control {
+
+public:
+
+    using clock = std::chrono::steady_clock;
+
+    admission_control(unsigned int target_ms, unsigned int interval_ms);
+
+    // false to refuse a request of a PRIORITY_ class before it queues
+    bool
+    admit(int priority);
+
+    // Records the time a request waited for its handler, false to shed it
+    bool
+    started(clock::duration sojourn, int priority);
+
+    bool
+    overloaded(){
+        return overloaded_.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    // Closes the interval ending before now
+    void
+    next_interval(std::int64_t now);
+
+    static std::int64_t
+    now_us(){
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            clock::now().time_since_epoch()).count();
+    }
+
+    const std::int64_t target_us_;
+    const std::int64_t interval_us_;
+    std::atomic<std::int64_t> interval_end_;
+    // the shortest wait seen in the current interval, -1 without one
+    std::atomic<std::int64_t> min_sojourn_us_{-1};
+    std::atomic<std::int64_t> last_sojourn_us_{0};
+    std::atomic<bool> overloaded_{false};
+};
+
+}
+
+#endif // ADMISSION_H
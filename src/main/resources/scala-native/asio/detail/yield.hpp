@@ -46,6 +46,66 @@ struct yield_completion {
     std::atomic< std::size_t >  use_count_{ 0 };
     mutex_t                     mtx_{};
     state_t                     state_{ init };
+    yield_completion        *   next_free_{ nullptr };
+
+    // Completions are recycled through a free list of the thread that
+    // drops the last reference, so an async operation on a warm thread
+    // does not touch the global heap. Completions released while the
+    // thread exits, after the list is gone, are deleted.
+    static bool & exited() {
+        static thread_local bool exited_{ false };
+        return exited_;
+    }
+
+    struct free_list {
+        yield_completion    *   head{ nullptr };
+        std::size_t             size{ 0 };
+
+        ~free_list() {
+            exited() = true;
+            while ( head) {
+                yield_completion * next = head->next_free_;
+                delete head;
+                head = next;
+            }
+        }
+    };
+
+    static free_list & cache() {
+        static thread_local free_list list;
+        return list;
+    }
+
+    static yield_completion * make() {
+        if ( exited() ) {
+            return new yield_completion{};
+        }
+        free_list & list = cache();
+        if ( nullptr == list.head) {
+            return new yield_completion{};
+        }
+        yield_completion * yc = list.head;
+        list.head = yc->next_free_;
+        --list.size;
+        yc->next_free_ = nullptr;
+        yc->state_ = init;
+        return yc;
+    }
+
+    static void recycle( yield_completion * yc) noexcept {
+        if ( exited() ) {
+            delete yc;
+            return;
+        }
+        free_list & list = cache();
+        if ( list.size >= 64) {
+            delete yc;
+            return;
+        }
+        yc->next_free_ = list.head;
+        list.head = yc;
+        ++list.size;
+    }
 
     void wait() {
         // yield_handler_base::operator()() will set state_ `complete` and
@@ -70,7 +130,7 @@ struct yield_completion {
         BOOST_ASSERT( nullptr != yc);
         if ( 1 == yc->use_count_.fetch_sub( 1, std::memory_order_release) ) {
             std::atomic_thread_fence( std::memory_order_acquire);
-            delete yc;
+            recycle( yc);
         }
     }
 };
@@ -204,7 +264,7 @@ void asio_handler_invoke( Fn&& fn, yield_handler< T > *) {
 class async_result_base {
 public:
     explicit async_result_base( yield_handler_base & h) :
-            ycomp_{ new yield_completion{} } {
+            ycomp_{ yield_completion::make() } {
         // Inject ptr to our yield_completion instance into this
         // yield_handler<>.
         h.ycomp_ = this->ycomp_;
@@ -0,0 +1,340 @@
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include <poll.h>
+
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/fiber/all.hpp>
+#include <boost/intrusive_ptr.hpp>
+
+#include "work_stealing.hpp"
+#include "yield.hpp"
+#include "spawn.hpp"
+
+namespace httpserver {
+namespace fiber {
+
+namespace {
+
+boost::asio::io_context* io_ = nullptr;
+std::atomic<bool> stopping_{false};
+std::atomic<std::size_t> live_{0};
+
+// Blocks until count threads arrived, the last one runs on_last before
+// releasing the others
+class barrier {
+
+public:
+
+    template <class F>
+    void
+    arrive_and_wait(std::size_t count, F on_last){
+        std::unique_lock<std::mutex> lock(mutex_);
+        if(++arrived_ == count){
+            on_last();
+            released_ = true;
+            release_.notify_all();
+            return;
+        }
+        release_.wait(lock, [this]{ return released_; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable release_;
+    std::size_t arrived_ = 0;
+    bool released_ = false;
+};
+
+barrier stopped_;
+
+// A handler fiber suspended on an io object, linked into a list for as
+// long as it waits so shutdown can cancel the wait. Lives on the fiber's
+// stack; unlinking takes the mutex, so it outlives a running cancel.
+class registered_wait {
+
+public:
+
+    template <class F>
+    explicit registered_wait(F& cancel)
+        :cancel_([](void* f){ (*static_cast<F*>(f))(); }),
+        target_(&cancel)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        next_ = head_;
+        if(head_ != nullptr)
+            head_->prev_ = this;
+        head_ = this;
+    }
+
+    ~registered_wait(){
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(prev_ != nullptr)
+            prev_->next_ = next_;
+        else
+            head_ = next_;
+        if(next_ != nullptr)
+            next_->prev_ = prev_;
+    }
+
+    registered_wait(const registered_wait&) = delete;
+    registered_wait& operator=(const registered_wait&) = delete;
+
+    static void
+    cancel_all(){
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(registered_wait* wait = head_; wait != nullptr; wait = wait->next_)
+            wait->cancel_(wait->target_);
+    }
+
+private:
+    void (*cancel_)(void*);
+    void* target_;
+    registered_wait* prev_ = nullptr;
+    registered_wait* next_ = nullptr;
+
+    static std::mutex mutex_;
+    static registered_wait* head_;
+};
+
+std::mutex registered_wait::mutex_;
+registered_wait* registered_wait::head_ = nullptr;
+
+// State of a wait_fd, shared with its timeout handler, which may run
+// after wait_fd returned. Recycled through a free list of the thread that
+// drops the last reference, like the yield completions.
+// The timer and shutdown may cancel the wait from other threads, the
+// mutex keeps them off the descriptor once the fiber released it.
+struct fd_wait {
+
+    explicit fd_wait(boost::asio::io_context& io) :descriptor(io) {}
+
+    void cancel(bool timeout){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(done)
+            return;
+        timed_out = timeout;
+        boost::system::error_code ec;
+        descriptor.cancel(ec);
+    }
+
+    static fd_wait* make(int fd);
+
+    friend void intrusive_ptr_add_ref(fd_wait* wait) noexcept {
+        wait->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    friend void intrusive_ptr_release(fd_wait* wait) noexcept;
+
+    boost::asio::posix::stream_descriptor descriptor;
+    std::mutex mutex;
+    bool done = false;
+    bool timed_out = false;
+    std::atomic<std::size_t> refs{0};
+    fd_wait* next_free = nullptr;
+};
+
+// records kept per thread beyond those in use
+const std::size_t max_free_waits = 64;
+
+// records released while the thread exits, after its list is gone, and
+// those on the list then are leaked: their io_context may be gone too
+thread_local bool waits_exited_ = false;
+
+struct fd_wait_list {
+    fd_wait* head = nullptr;
+    std::size_t size = 0;
+
+    ~fd_wait_list(){
+        waits_exited_ = true;
+    }
+};
+
+fd_wait_list&
+free_waits(){
+    static thread_local fd_wait_list list;
+    return list;
+}
+
+fd_wait*
+fd_wait::make(int fd){
+
+    fd_wait* wait = nullptr;
+
+    if(!waits_exited_){
+        fd_wait_list& list = free_waits();
+        if(list.head != nullptr){
+            wait = list.head;
+            list.head = wait->next_free;
+            list.size--;
+        }
+    }
+
+    if(wait == nullptr)
+        wait = new fd_wait(*io_);
+
+    wait->next_free = nullptr;
+    wait->done = false;
+    wait->timed_out = false;
+    wait->descriptor.assign(fd);
+    return wait;
+}
+
+void
+intrusive_ptr_release(fd_wait* wait) noexcept {
+
+    if(wait->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    if(waits_exited_)
+        return;
+
+    fd_wait_list& list = free_waits();
+    if(list.size >= max_free_waits){
+        delete wait;
+        return;
+    }
+    wait->next_free = list.head;
+    list.head = wait;
+    list.size++;
+}
+
+}
+
+void
+run(boost::asio::io_context& io, std::uint32_t thread_count){
+    io_ = &io;
+    boost::fibers::use_scheduling_algorithm<boost::fibers::asio::work_stealing>(io, thread_count);
+    auto algo = boost::fibers::asio::work_stealing::current();
+
+    while(!io.stopped())
+        algo->run_one();
+
+    // the scheduler is destroyed with this thread and waits for every
+    // fiber attached to it; once all threads left io, wake the suspended
+    // fibers and run io until they are done
+    stopped_.arrive_and_wait(thread_count, [&io]{
+        stopping_ = true;
+        io.restart();
+        registered_wait::cancel_all();
+    });
+
+    while(live_ > 0){
+        io.poll();
+        boost::this_fiber::yield();
+    }
+}
+
+void
+detail::started(){
+    live_++;
+}
+
+void
+detail::finished(){
+    live_--;
+}
+
+// handler fibers are the only worker fibers, the main fiber runs the
+// io_context and must never suspend inside a completion handler
+bool
+in_fiber(){
+    return io_ != nullptr
+        && boost::fibers::context::active()->is_context(boost::fibers::type::worker_context);
+}
+
+void
+yield(){
+    if(in_fiber())
+        boost::this_fiber::yield();
+}
+
+void
+sleep(unsigned int ms){
+
+    if(!in_fiber() || stopping_)
+        return;
+
+    // on io rather than this_fiber::sleep_for so shutdown can cut it short
+    boost::asio::steady_timer timer(*io_);
+    auto cancel = [&timer]{ timer.cancel(); };
+    registered_wait wait(cancel);
+
+    boost::system::error_code ec;
+    timer.expires_after(std::chrono::milliseconds(ms));
+    timer.async_wait(boost::fibers::asio::yield[ec]);
+}
+
+namespace {
+
+bool
+ready(int fd, bool write){
+    pollfd p = {fd, static_cast<short>(write ? POLLOUT : POLLIN), 0};
+    return ::poll(&p, 1, 0) != 0;
+}
+
+}
+
+int
+wait_fd(int fd, bool write, unsigned int timeout_ms){
+
+    if(!in_fiber() || stopping_)
+        return -1;
+
+    boost::intrusive_ptr<fd_wait> state(fd_wait::make(fd));
+    boost::asio::steady_timer timer(*io_);
+
+    if(timeout_ms > 0){
+        timer.expires_after(std::chrono::milliseconds(timeout_ms));
+        timer.async_wait([state](boost::system::error_code ec){
+            if(!ec)
+                state->cancel(true);
+        });
+    }
+
+    boost::system::error_code ec;
+    bool is_ready = false;
+    {
+        auto cancel = [&state]{ state->cancel(false); };
+        registered_wait wait(cancel);
+
+        // fd is registered with the reactor since make, readiness from
+        // then on completes the wait, so checking the fd first loses none.
+        // The check also runs after each wake-up: the reactor reuses the
+        // state of released descriptors, and an event of an earlier fd
+        // with this number can complete the wait.
+        while(!(is_ready = ready(fd, write))){
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if(state->timed_out || stopping_)
+                    break;
+            }
+
+            state->descriptor.async_wait(
+                write ? boost::asio::posix::stream_descriptor::wait_write
+                      : boost::asio::posix::stream_descriptor::wait_read,
+                boost::fibers::asio::yield[ec]);
+
+            if(ec)
+                break;
+        }
+    }
+
+    timer.cancel();
+
+    // released, never closed, the caller keeps fd
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->done = true;
+    state->descriptor.release();
+
+    if(is_ready)
+        return 0;
+    return state->timed_out ? 1 : -1;
+}
+}
+}
@@ -0,0 +1,72 @@
+#ifndef HTTPSERVER_ASIO_SPAWN_HPP
+#define HTTPSERVER_ASIO_SPAWN_HPP
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/fiber/fiber.hpp>
+
+#include "../final_action.h"
+#include "stack_pool.hpp"
+
+namespace httpserver {
+
+// Handlers on Boost.Fiber: each io thread's main fiber runs the io_context
+// and hands the thread to ready handler fibers in between, a handler that
+// waits through the yield token (asio/yield.hpp) or the calls below
+// suspends only its own fiber. Ready fibers migrate to idle io threads
+// (asio/work_stealing.hpp), so a handler may resume on another thread.
+namespace fiber {
+
+// runs io on the calling thread, one of thread_count threads that all call
+// this once per process. Returns once io is stopped and the handler fibers
+// finished, their pending waits are cancelled.
+void
+run(boost::asio::io_context& io, std::uint32_t thread_count);
+
+namespace detail {
+
+// handler fibers not finished yet, run waits for them on shutdown
+void
+started();
+
+void
+finished();
+
+}
+
+// runs fn on a new detached fiber of the calling thread; fn is moved onto
+// the fiber's pooled stack with its context, nothing goes to the heap
+template <class Fn>
+void
+spawn(Fn&& fn){
+    detail::started();
+    boost::fibers::fiber(std::allocator_arg, stack_pool(), [fn = std::forward<Fn>(fn)]() mutable {
+        auto done = finally([]{ detail::finished(); });
+        fn();
+    }).detach();
+}
+
+// true when the caller runs on a handler fiber
+bool
+in_fiber();
+
+// lets the other ready fibers run
+void
+yield();
+
+void
+sleep(unsigned int ms);
+
+// suspends until fd is readable (or writable), returns 0, 1 on timeout
+// (0 waits forever) or -1 on error, on shutdown or outside a handler fiber
+int
+wait_fd(int fd, bool write, unsigned int timeout_ms);
+
+}
+
+}
+
+#endif // HTTPSERVER_ASIO_SPAWN_HPP
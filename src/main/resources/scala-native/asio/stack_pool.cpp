@@ -0,0 +1,167 @@
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <boost/context/stack_traits.hpp>
+
+#include "stack_pool.hpp"
+
+namespace httpserver {
+namespace fiber {
+
+namespace {
+
+std::size_t page_ = 0;
+std::size_t size_ = 0;
+bool huge_pages_ = false;
+
+// stacks kept per thread beyond what is in use
+const std::size_t max_free = 256;
+
+// The stacks of one thread. Other threads return stacks under the mutex,
+// the pool outlives its thread until the last of its stacks is back.
+struct pool {
+    std::vector<void*> local;           // owner thread only
+    std::mutex mutex;
+    std::vector<void*> remote;          // freed by other threads
+    bool closed = false;
+    std::atomic<std::size_t> refs{1};   // the thread and each stack out
+
+    pool(){
+        local.reserve(max_free);
+        remote.reserve(max_free);
+    }
+
+    void release(){
+        if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+};
+
+// kept above sp, at the top of each stack
+struct stack_header {
+    pool* owner;
+};
+
+const std::size_t header_size = 64;
+
+// the fiber scheduler is a thread_local created before the list, stacks
+// it releases while the thread exits bypass the destroyed list
+thread_local bool exited_ = false;
+
+struct free_list {
+    pool* stacks = new pool;
+
+    ~free_list(){
+        exited_ = true;
+        {
+            std::lock_guard<std::mutex> lock(stacks->mutex);
+            stacks->closed = true;
+            for(void* base : stacks->remote)
+                munmap(base, page_ + size_);
+            stacks->remote.clear();
+        }
+        for(void* base : stacks->local)
+            munmap(base, page_ + size_);
+        stacks->local.clear();
+        stacks->release();
+    }
+};
+
+free_list&
+cache(){
+    static thread_local free_list list;
+    return list;
+}
+
+stack_header*
+header(void* base){
+    return reinterpret_cast<stack_header*>(static_cast<char*>(base) + page_ + size_ - header_size);
+}
+
+}
+
+void
+stack_pool::configure(std::size_t size, bool huge_pages){
+    page_ = sysconf(_SC_PAGESIZE);
+    if(size == 0)
+        size = boost::context::stack_traits::default_size();
+    // whole pages, the guard page takes one more
+    size_ = (size + page_ - 1) / page_ * page_;
+    huge_pages_ = huge_pages;
+}
+
+boost::context::stack_context
+stack_pool::allocate(){
+
+    if(size_ == 0)
+        configure(0, false);
+
+    void* base;
+    pool* stacks = cache().stacks;
+
+    if(stacks->local.empty()){
+        std::lock_guard<std::mutex> lock(stacks->mutex);
+        stacks->local.swap(stacks->remote);
+    }
+
+    if(!stacks->local.empty()){
+        base = stacks->local.back();
+        stacks->local.pop_back();
+    } else {
+        base = mmap(NULL, page_ + size_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if(base == MAP_FAILED)
+            throw std::bad_alloc();
+
+        // stacks grow down, overflowing one faults on the guard page
+        mprotect(base, page_, PROT_NONE);
+#ifdef MADV_HUGEPAGE
+        if(huge_pages_)
+            madvise(static_cast<char*>(base) + page_, size_, MADV_HUGEPAGE);
+#endif
+    }
+
+    header(base)->owner = stacks;
+    stacks->refs.fetch_add(1, std::memory_order_relaxed);
+
+    boost::context::stack_context sctx;
+    sctx.size = size_ - header_size;
+    sctx.sp = static_cast<char*>(base) + page_ + size_ - header_size;
+    return sctx;
+}
+
+void
+stack_pool::deallocate(boost::context::stack_context& sctx) noexcept {
+
+    void* base = static_cast<char*>(sctx.sp) + header_size - size_ - page_;
+    pool* owner = header(base)->owner;
+
+    if(!exited_ && owner == cache().stacks){
+        if(owner->local.size() < max_free){
+            owner->local.push_back(base);
+            return owner->release();
+        }
+        munmap(base, page_ + size_);
+        return owner->release();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(owner->mutex);
+        if(!owner->closed && owner->remote.size() < max_free){
+            owner->remote.push_back(base);
+            base = NULL;
+        }
+    }
+
+    if(base != NULL)
+        munmap(base, page_ + size_);
+    owner->release();
+}
+
+}
+}
@@ -0,0 +1,35 @@
+#ifndef HTTPSERVER_ASIO_STACK_POOL_HPP
+#define HTTPSERVER_ASIO_STACK_POOL_HPP
+
+#include <cstddef>
+
+#include <boost/context/stack_context.hpp>
+
+namespace httpserver {
+namespace fiber {
+
+// StackAllocator for handler fibers: fixed size mmap'ed stacks with a
+// PROT_NONE guard page below them, kept on a free list of the thread that
+// allocated them. A fiber stolen by another thread hands its stack back to
+// that list when it ends. After warm-up spawning a fiber costs no syscall.
+class stack_pool {
+
+public:
+
+    // size 0 keeps the Boost.Context default; huge_pages asks for
+    // transparent huge pages, which only pays off with stacks of 2MB or
+    // more. Called before the first fiber is spawned.
+    static void
+    configure(std::size_t size, bool huge_pages);
+
+    boost::context::stack_context
+    allocate();
+
+    void
+    deallocate(boost::context::stack_context& sctx) noexcept;
+};
+
+}
+}
+
+#endif // HTTPSERVER_ASIO_STACK_POOL_HPP
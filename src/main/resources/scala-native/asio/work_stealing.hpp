@@ -0,0 +1,92 @@
+#ifndef BOOST_FIBERS_ASIO_WORK_STEALING_H
+#define BOOST_FIBERS_ASIO_WORK_STEALING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+#include <boost/fiber/algo/work_stealing.hpp>
+#include <boost/fiber/context.hpp>
+#include <boost/fiber/operations.hpp>
+#include <boost/intrusive_ptr.hpp>
+
+namespace boost::fibers::asio {
+
+// algo::work_stealing for threads that share one io_context. Each thread's
+// main fiber runs the io_context with run_one() and yields after every
+// handler, so ready fibers run between handlers and an idle thread, once
+// woken, steals ready fibers from the queue of a busy one.
+//
+// Unlike round_robin there is no service or posted loop, every thread
+// installs its own instance and calls run_one() itself. algo::work_stealing
+// keeps its schedulers in static state: install it on exactly thread_count
+// threads, once per process.
+class work_stealing : public algo::work_stealing {
+private:
+    boost::asio::io_context &io_svc_;
+    // set while this thread is blocked in io_svc_.run_one()
+    std::atomic<bool> in_io_{false};
+    // a fiber of this thread was scheduled from another thread
+    std::atomic<bool> pending_{false};
+
+    static inline thread_local work_stealing *current_ = nullptr;
+    // threads blocked in run_one(), woken when there is work to steal
+    static inline std::atomic<std::size_t> idle_{0};
+
+    // Fibers made ready from another thread land in our remote queue,
+    // which only this thread drains. The io_context is shared, so the
+    // wake-up is passed on until the owner runs it.
+    static void wake(boost::intrusive_ptr<work_stealing> self) {
+        if (current_ == self.get() || !self->in_io_.load()) {
+            return;
+        }
+        boost::asio::post(self->io_svc_, [self]() { wake(self); });
+    }
+
+public:
+    work_stealing(boost::asio::io_context &io_svc, std::uint32_t thread_count)
+        : algo::work_stealing(thread_count, false), io_svc_(io_svc) {
+        current_ = this;
+    }
+
+    // the instance installed on the calling thread
+    static work_stealing *current() noexcept {
+        return current_;
+    }
+
+    // Runs one io handler, blocking if there is none, then lets the
+    // ready fibers run
+    void run_one() {
+        in_io_.store(true);
+        if (!pending_.exchange(false)) {
+            ++idle_;
+            io_svc_.run_one();
+            --idle_;
+        }
+        in_io_.store(false);
+        pending_.store(false);
+        this_fiber::yield();
+    }
+
+    void awakened(context *ctx) noexcept override {
+        algo::work_stealing::awakened(ctx);
+        // a stealable fiber while other threads sleep in the io_context
+        if (!ctx->is_context(type::pinned_context) && idle_.load() > 0) {
+            boost::asio::post(io_svc_, []() {});
+        }
+    }
+
+    void notify() noexcept override {
+        pending_.store(true);
+        if (in_io_.load()) {
+            boost::asio::post(io_svc_, [self = boost::intrusive_ptr<work_stealing>(this)]() {
+                wake(self);
+            });
+        }
+    }
+};
+
+}  // namespace boost::fibers::asio
+
+#endif  // BOOST_FIBERS_ASIO_WORK_STEALING_H
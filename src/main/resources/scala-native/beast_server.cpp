@@ -1,7 +1,11 @@
 
 #include <stdlib.h>
+#include <arpa/inet.h>
+#include <chrono>
 #include "httpserver.h"
 #include "beast_server.h"
+#include "asio/spawn.hpp"
+#include "access_log.h"
 
 extern "C" {
 
@@ -15,6 +19,7 @@ header_t* header_new(const char* name, const char* value){
 
 headers_t* headers_new(int& size){
     headers_t* headers = (headers_t*) malloc(sizeof(headers_t));
+    headers->headers = NULL;
     headers->size = size;
     return headers;
 }
@@ -24,6 +29,20 @@ body_t* body_new(const char* content, const char* raw, int& size) {
     body->body = content;
     body->body_raw = raw;
     body->size = size;
+    body->release = NULL;
+    body->fd = -1;
+    body->offset = 0;
+    return body;
+}
+
+body_t* body_file_new(int fd, long unsigned int offset, long unsigned int size) {
+    body_t* body = (body_t*) malloc(sizeof(body_t));
+    body->body = NULL;
+    body->body_raw = NULL;
+    body->size = size;
+    body->release = NULL;
+    body->fd = fd;
+    body->offset = offset;
     return body;
 }
 
@@ -35,6 +54,14 @@ request_t* request_new(const char* verb, const char* target){
     req->target = target;
     req->content_type = NULL;
     req->opts = NULL;
+    req->handler_ = NULL;
+    req->client = NULL;
+    req->local = NULL;
+    req->peer = NULL;
+    req->deadline_ms = 0;
+    req->cancelled = 0;
+    req->on_cancel_ = NULL;
+    req->priority = PRIORITY_NORMAL;
     return req;
 }
 
@@ -48,18 +75,125 @@ response_t* response_new(int status_code){
     return resp;
 }
 
+endpoints_t* endpoints_new(int size){
+    endpoints_t* endpoints = (endpoints_t*) malloc(sizeof(endpoints_t));
+    endpoints->endpoints = (endpoint_t*) calloc(size, sizeof(endpoint_t));
+    endpoints->size = size;
+    return endpoints;
+}
+
+routes_t* routes_new(int size){
+    routes_t* routes = (routes_t*) malloc(sizeof(routes_t));
+    routes->routes = (route_t*) calloc(size, sizeof(route_t));
+    routes->size = size;
+    return routes;
+}
+
+server_opts* server_opts_new(){
+    server_opts* opts = (server_opts*) malloc(sizeof(server_opts));
+    opts->endpoints = NULL;
+    opts->zerocopy_threshold = 0;
+    opts->drain_timeout_ms = 0;
+    opts->handoff_path = NULL;
+    opts->max_connections = 0;
+    opts->max_listener_connections = 0;
+    opts->header_timeout_ms = 5000;
+    opts->body_timeout_ms = 5000;
+    opts->body_min_rate = 0;
+    opts->handler_timeout_ms = 0;
+    opts->write_timeout_ms = 5000;
+    opts->keepalive_timeout_ms = 5000;
+    opts->max_header_size = 0;
+    opts->max_header_count = 0;
+    opts->max_body_size = 8 * 1024 * 1024;
+    opts->routes = NULL;
+    opts->precheck = NULL;
+    opts->proxy_protocol = 0;
+    opts->worker_threads = 0;
+    opts->worker_queue_size = 1024;
+    opts->admission_target_ms = 0;
+    opts->admission_interval_ms = 100;
+    opts->priority_header = NULL;
+    opts->liveness_path = NULL;
+    opts->readiness_path = NULL;
+    opts->metrics_path = NULL;
+    opts->histograms_path = NULL;
+    opts->rate_limit = 0;
+    opts->rate_limit_burst = 0;
+    opts->rate_limit_header = NULL;
+    opts->rate_limit_clients = 65536;
+    opts->access_log_path = NULL;
+    opts->access_log_level = ACCESS_LOG_ALL;
+    opts->access_log_sample = 1;
+    opts->access_log_buffer = 4096;
+    opts->slow_request_ms = 0;
+    opts->slow_requests_kept = 100;
+    opts->slow_requests_path = NULL;
+    opts->fibers = 0;
+    opts->fiber_stack_size = 0;
+    opts->fiber_huge_pages = 0;
+    return opts;
+}
+
+long int request_remaining_ms(const request_t* req){
+    if(req->deadline_ms == 0)
+        return -1;
+
+    long int now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return req->deadline_ms > now ? req->deadline_ms - now : 0;
+}
+
+int request_cancelled(const request_t* req){
+    return __atomic_load_n(&req->cancelled, __ATOMIC_SEQ_CST);
+}
+
+void request_on_cancel(request_t* req, request_cancel_callback_t callback){
+    __atomic_store_n(&req->on_cancel_, callback, __ATOMIC_SEQ_CST);
+    if(request_cancelled(req))
+        httpserver::cancel_request(req);
+}
+
+int address_format(const address_t* addr, char* buf, int size){
+    if(addr == NULL || size <= 0)
+        return -1;
+
+    if(addr->family == AF_INET || addr->family == AF_INET6){
+        if(inet_ntop(addr->family, addr->addr, buf, size) == NULL)
+            return -1;
+        return strlen(buf);
+    }
+
+    const char* name = addr->family == AF_UNIX ? "unix" : "unknown";
+    if((int) strlen(name) >= size)
+        return -1;
+    strcpy(buf, name);
+    return strlen(buf);
+}
+
+void access_log_level(int level){
+    httpserver::access_log::level = level;
+}
+
+void fiber_yield(){
+    httpserver::fiber::yield();
+}
+
+void fiber_sleep(unsigned int ms){
+    httpserver::fiber::sleep(ms);
+}
+
+int fiber_wait_fd(int fd, int write, unsigned int timeout_ms){
+    return httpserver::fiber::wait_fd(fd, write != 0, timeout_ms);
+}
+
 void headers_free(headers_t* headers){
 
     if(headers != NULL){
 
-        int size = headers->size;
-        header_t* hs = headers->headers;
-
-        while(hs != NULL && size >= 0) {
-            free(hs);
-            hs++;
-            size--;
-        }
+        // one array for all headers, see handle_request
+        if(headers->headers != NULL)
+            free(headers->headers);
 
         free(headers);
     }
@@ -87,16 +221,20 @@ int run(
     char* hostname,
     unsigned short port,
     unsigned short max_thread_count,
+    server_opts* opts,
     beast_handler_t* handler){
 
 
-    std::cout << "run with hostname=" << hostname
+    std::cout << "run with hostname=" << (hostname != NULL ? hostname : "")
               << ", port=" << port
               << ", max_thread_count=" << max_thread_count
               << std::endl;
 
+    if(opts == NULL)
+        opts = server_opts_new();
+
     //httpserver::http_handler_mock handler;
-    return httpserver::run(hostname, port, max_thread_count, handler);
+    return httpserver::run(hostname, port, max_thread_count, opts, handler);
 }
 
 //typedef void (*http_get_async_callback_t) (request* req, response_callback_t resp);
@@ -109,7 +247,20 @@ int run_sync(
     beast_handler_t* handler = (beast_handler_t *) malloc(sizeof(beast_handler_t));
     handler->sync = callback;
     handler->async = NULL;
-    return run(hostname, port, max_thread_count, handler);
+    return run(hostname, port, max_thread_count, NULL, handler);
+}
+
+int run_sync_opts(
+    char* hostname,
+    unsigned short port,
+    unsigned short max_thread_count,
+    server_opts* opts,
+    http_handler_callback_t callback){
+
+    beast_handler_t* handler = (beast_handler_t *) malloc(sizeof(beast_handler_t));
+    handler->sync = callback;
+    handler->async = NULL;
+    return run(hostname, port, max_thread_count, opts, handler);
 }
 
 int run_async(
@@ -121,7 +272,20 @@ int run_async(
     beast_handler_t* handler = (beast_handler_t *) malloc(sizeof(beast_handler_t));
     handler->async = callback;
     handler->sync = NULL;
-    return run(hostname, port, max_thread_count, handler);
+    return run(hostname, port, max_thread_count, NULL, handler);
+}
+
+int run_async_opts(
+    char* hostname,
+    unsigned short port,
+    unsigned short max_thread_count,
+    server_opts* opts,
+    http_handler_async_callback_t callback){
+
+    beast_handler_t* handler = (beast_handler_t *) malloc(sizeof(beast_handler_t));
+    handler->async = callback;
+    handler->sync = NULL;
+    return run(hostname, port, max_thread_count, opts, handler);
 }
 
 response_t* callback_sync(request_t* req){
@@ -12,10 +12,20 @@ extern "C" {
         const char* value;
     } header_t;
 
+    // called once the server no longer reads body_raw
+    typedef void (*body_release_callback_t)(const char* body_raw, long unsigned int size);
+
+    // A body is either a string, raw bytes (which may point into an mmap
+    // region, unmapped from release) or, when fd >= 0, size bytes of fd
+    // starting at offset sent with sendfile. The server owns and closes fd.
+    // Bodies that are not files set fd to -1, as body_new does.
     typedef struct {
         const char* body;
         const char* body_raw;
         long unsigned int size;
+        body_release_callback_t release;
+        int fd;
+        long unsigned int offset;
     } body_t;
 
     typedef struct {
@@ -32,7 +42,34 @@ extern "C" {
         int noop;
     } response_opts;
 
-    typedef struct  {
+    // Priority classes, pooled handlers of a higher class run first and
+    // high priority requests are never shed
+    enum {
+        PRIORITY_NORMAL = 0,
+        PRIORITY_HIGH = 1,
+        PRIORITY_LOW = 2
+    };
+
+    // access log levels, errors are responses with a status of 400 or more
+    enum {
+        ACCESS_LOG_OFF = 0,
+        ACCESS_LOG_ERRORS = 1,
+        ACCESS_LOG_ALL = 2
+    };
+
+    // A socket address kept in binary form, address_format renders it
+    typedef struct {
+        int family;             // AF_INET, AF_INET6, AF_UNIX, 0 when unknown
+        unsigned short port;
+        unsigned char addr[16]; // network order, 4 bytes for AF_INET
+    } address_t;
+
+    struct request_s;
+
+    // called once when the client of a request in progress went away
+    typedef void (*request_cancel_callback_t)(struct request_s* req);
+
+    typedef struct request_s {
         const char* verb;
         const char* target;
         const char* content_type;
@@ -40,6 +77,21 @@ extern "C" {
         headers_t* headers;
         request_opts* opts;
         void *handler_;
+        // the client as sent in a PROXY header, else the peer
+        const address_t* client;
+        const address_t* local;
+        // the connected socket, the load balancer behind a PROXY header
+        const address_t* peer;
+        // CLOCK_MONOTONIC milliseconds the response is due by, counted from
+        // the end of the header, 0 without a handler timeout
+        long int deadline_ms;
+        // set when the client disconnects before an async, pooled or fiber
+        // handler answered, read it with request_cancelled
+        int cancelled;
+        // see request_on_cancel
+        request_cancel_callback_t on_cancel_;
+        // PRIORITY_ class from the route or opts->priority_header
+        int priority;
     } request_t;
 
 
@@ -56,11 +108,148 @@ extern "C" {
     typedef response_t* (*http_handler_callback_t) (request_t* req);
     typedef void (*http_handler_async_callback_t) (request_t* req, response_callback_t cb);
 
+    // Decides on a request from its header alone, returns 0 to accept it
+    // or the status code to refuse it with
+    typedef int (*http_precheck_callback_t)(request_t* req);
+
     typedef struct {
         http_handler_callback_t sync;
         http_handler_async_callback_t async;
     } beast_handler_t;
 
+    typedef struct {
+        const char* address;    // IPv4 or IPv6 address
+        unsigned short port;
+        const char* unix_path;  // AF_UNIX stream socket path, replaces address/port when set
+    } endpoint_t;
+
+    typedef struct {
+        endpoint_t* endpoints;
+        int size;
+    } endpoints_t;
+
+    // Settings for the requests whose target starts with prefix, the
+    // longest matching prefix wins. 0 falls back to the server setting.
+    typedef struct {
+        const char* prefix;
+        long unsigned int max_body_size;
+        unsigned int handler_timeout_ms;
+        // at most this many handlers of the route run at once, fewer while
+        // their latency grows; max_queued more wait for a slot, others get
+        // a 503. 0 is unlimited.
+        unsigned int max_concurrency;
+        unsigned int max_queued;
+        // PRIORITY_ class of the route's requests
+        int priority;
+        // checked once the header is read, so they can only be lower than
+        // the server's max_header_size, which bounds reading any header
+        unsigned int max_header_size;
+        int max_header_count;
+    } route_t;
+
+    typedef struct {
+        route_t* routes;
+        int size;
+    } routes_t;
+
+    typedef struct {
+        // listeners in addition to the hostname/port passed to run
+        endpoints_t* endpoints;
+        // send body_raw of at least this size with MSG_ZEROCOPY, 0 disables
+        long unsigned int zerocopy_threshold;
+        // on SIGINT/SIGTERM stop accepting and wait up to this long for
+        // in-flight requests before stopping, 0 stops immediately
+        unsigned int drain_timeout_ms;
+        // AF_UNIX path used to take the listening sockets over from the
+        // running server on start, and to hand them to the next one
+        const char* handoff_path;
+        // stop accepting while this many connections are open, per server
+        // and per listener, 0 is unlimited; connections wait in the backlog
+        unsigned int max_connections;
+        unsigned int max_listener_connections;
+        // per phase timeouts in milliseconds, 0 disables one; the body
+        // timeout grows by a second per body_min_rate bytes received
+        unsigned int header_timeout_ms;
+        unsigned int body_timeout_ms;
+        unsigned int body_min_rate;
+        // an async, pooled or fiber handler that has not answered by then
+        // gets a 504 for its request, its late answer is dropped
+        unsigned int handler_timeout_ms;
+        unsigned int write_timeout_ms;
+        unsigned int keepalive_timeout_ms;
+        // requests over these limits are refused with 431/413 before their
+        // body is read, 0 is unlimited (beast's default 8KB for the header)
+        unsigned int max_header_size;
+        int max_header_count;
+        long unsigned int max_body_size;
+        routes_t* routes;
+        // consulted before answering Expect: 100-continue, NULL accepts
+        http_precheck_callback_t precheck;
+        // every connection starts with a PROXY protocol v1/v2 header,
+        // others are closed
+        int proxy_protocol;
+        // run sync handlers on this many worker threads instead of the io
+        // threads, 0 disables; a full queue answers 503
+        unsigned int worker_threads;
+        unsigned int worker_queue_size;
+        // CoDel admission control of pooled and fiber handlers: once the
+        // shortest wait for a handler over an interval stays above the
+        // target, requests queued too long get a 503 with Retry-After
+        // instead of running, 0 disables; the interval defaults to 100ms
+        unsigned int admission_target_ms;
+        unsigned int admission_interval_ms;
+        // a request header naming the priority class ("high", "normal" or
+        // "low") of requests outside a prioritized route, NULL ignores it;
+        // set it at a proxy, clients could claim any class
+        const char* priority_header;
+        // answered 200 by the server itself, without calling the handler;
+        // the readiness path answers 503 once the server drains. NULL
+        // disables either.
+        const char* liveness_path;
+        const char* readiness_path;
+        // counters in the Prometheus text format, served like the above
+        const char* metrics_path;
+        // per route latency histograms of each phase of a request, as an
+        // HdrHistogram log since the start, served like the above; NULL
+        // records none
+        const char* histograms_path;
+        // requests a second allowed per client, up to rate_limit_burst at
+        // once, others get a 429 as soon as their header is read; 0
+        // disables. Clients are told apart by the rate_limit_header value
+        // or, without one, by their address; AF_UNIX clients by their
+        // process credentials. The server's own endpoints and high priority
+        // routes pass, priority_header does not exempt a request.
+        unsigned int rate_limit;
+        unsigned int rate_limit_burst;
+        const char* rate_limit_header;
+        // clients tracked at once, the least recently seen are forgotten
+        unsigned int rate_limit_clients;
+        // a JSON line per response appended to this file, "-" for stdout,
+        // by a background thread; NULL logs nothing. Below ACCESS_LOG_ALL
+        // only errors are logged, access_log_sample keeps 1 in that many
+        // of the other responses. Records that do not fit the per thread
+        // buffer of access_log_buffer records are dropped.
+        const char* access_log_path;
+        int access_log_level;
+        unsigned int access_log_sample;
+        unsigned int access_log_buffer;
+        // requests taking slow_request_ms or more, from their first byte
+        // to their response written, are kept with the time of each phase;
+        // the last slow_requests_kept are served at slow_requests_path like
+        // the metrics. 0 keeps none.
+        unsigned int slow_request_ms;
+        unsigned int slow_requests_kept;
+        const char* slow_requests_path;
+        // run sync handlers on fibers of the io threads, a handler waiting
+        // in the fiber_ calls lets its thread serve other requests, ready
+        // fibers move to idle threads
+        int fibers;
+        // stack size of a handler fiber in bytes, 0 is the Boost.Context
+        // default; huge pages only pay off with stacks of 2MB or more
+        unsigned int fiber_stack_size;
+        int fiber_huge_pages;
+    } server_opts;
+
     // initializers
 
     header_t* header_new(const char* name, const char* value);
@@ -69,10 +258,48 @@ extern "C" {
 
     body_t* body_new(const char* content, const char* raw, int& size) ;
 
+    body_t* body_file_new(int fd, long unsigned int offset, long unsigned int size);
+
     request_t* request_new(const char* verb, const char* target);
 
     response_t* response_new(int status_code);
 
+    endpoints_t* endpoints_new(int size);
+
+    routes_t* routes_new(int size);
+
+    server_opts* server_opts_new();
+
+    // milliseconds left until req->deadline_ms, 0 once it passed, -1
+    // without a deadline
+    long int request_remaining_ms(const request_t* req);
+
+    // non-zero once the client of req disconnected, the answer is not read
+    // and a cancelled handler may answer NULL
+    int request_cancelled(const request_t* req);
+
+    // calls callback once, on an io thread, when the client disconnects,
+    // or right away if it already did
+    void request_on_cancel(request_t* req, request_cancel_callback_t callback);
+
+    // writes the address without the port to buf, returns its length or
+    // -1 if it does not fit
+    int address_format(const address_t* addr, char* buf, int size);
+
+    // switches the ACCESS_LOG_ level of a running server with an access log
+    void access_log_level(int level);
+
+    // for handlers running on fibers, no-ops (fiber_wait_fd returns -1)
+    // anywhere else
+
+    void fiber_yield();
+
+    void fiber_sleep(unsigned int ms);
+
+    // waits for fd to become readable, or writable if write is non-zero;
+    // returns 0, 1 on timeout (0 waits forever) or -1 on error
+    int fiber_wait_fd(int fd, int write, unsigned int timeout_ms);
+
     void headers_free(headers_t* headers);
 
     void request_free(request_t* req);
@@ -0,0 +1,96 @@
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "concurrency_limit.h"
+
+namespace httpserver {
+
+concurrency_limit::concurrency_limit(unsigned int max_limit, unsigned int queue_size)
+    :max_limit_(max_limit),
+    queue_size_(queue_size),
+    limit_(max_limit)
+{
+}
+
+bool
+concurrency_limit::acquire(std::function<void()> start){
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if(in_flight_ >= slots()){
+            if(waiting_.size() >= queue_size_)
+                return false;
+            waiting_.push_back(std::move(start));
+            return true;
+        }
+
+        in_flight_++;
+    }
+
+    start();
+    return true;
+}
+
+void
+concurrency_limit::release(clock::duration latency){
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    in_flight_--;
+    update(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+    start_waiting(lock);
+}
+
+void
+concurrency_limit::release(){
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    in_flight_--;
+    start_waiting(lock);
+}
+
+unsigned int
+concurrency_limit::limit(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    return slots();
+}
+
+void
+concurrency_limit::update(double latency_us){
+
+    latency_us = std::max(latency_us, 1.0);
+
+    if(samples_++ % 500 == 0 || latency_us < min_latency_us_)
+        min_latency_us_ = latency_us;
+
+    double gradient = std::max(0.5, std::min(1.0, min_latency_us_ / latency_us));
+    double target = limit_ * gradient + std::sqrt(limit_);
+
+    // a route using half its limit says nothing about a higher one
+    if(target > limit_ && in_flight_ + 1 < limit_ / 2)
+        return;
+
+    limit_ = std::max(1.0, std::min<double>(max_limit_, 0.8 * limit_ + 0.2 * target));
+}
+
+// The queued calls run outside the lock, they may release right away
+void
+concurrency_limit::start_waiting(std::unique_lock<std::mutex>& lock){
+
+    std::vector<std::function<void()>> starts;
+
+    while(!waiting_.empty() && in_flight_ < slots()){
+        in_flight_++;
+        starts.push_back(std::move(waiting_.front()));
+        waiting_.pop_front();
+    }
+
+    lock.unlock();
+
+    for(auto& start : starts)
+        start();
+}
+
+}
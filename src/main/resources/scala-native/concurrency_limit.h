@@ -0,0 +1,72 @@
+#ifndef CONCURRENCY_LIMIT_H
+#define CONCURRENCY_LIMIT_H
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace httpserver {
+
+// Bulkhead for the handlers of one route: at most limit() calls run at
+// once, a few more wait in a bounded queue and the rest are refused.
+//
+// The limit adapts to the latency of the calls (the gradient algorithm):
+// it shrinks by the ratio of the shortest latency seen to the current one
+// and grows by its square root while latency stays flat, between 1 and
+// the configured maximum.
+class concurrency_limit {
+
+public:
+
+    using clock = std::chrono::steady_clock;
+
+    concurrency_limit(unsigned int max_limit, unsigned int queue_size);
+
+    concurrency_limit(const concurrency_limit&) = delete;
+    concurrency_limit& operator=(const concurrency_limit&) = delete;
+
+    // Runs start now when below the limit or once a call releases its
+    // slot, from the releasing thread; false when the queue is full
+    bool
+    acquire(std::function<void()> start);
+
+    // Ends a call admitted by acquire that ran for latency
+    void
+    release(clock::duration latency);
+
+    // Ends a call admitted by acquire that never ran
+    void
+    release();
+
+    unsigned int
+    limit();
+
+private:
+
+    unsigned int
+    slots(){
+        return static_cast<unsigned int>(limit_);
+    }
+
+    void
+    update(double latency_us);
+
+    void
+    start_waiting(std::unique_lock<std::mutex>& lock);
+
+    const unsigned int max_limit_;
+    const unsigned int queue_size_;
+    std::mutex mutex_;
+    std::deque<std::function<void()>> waiting_;
+    unsigned int in_flight_ = 0;
+    double limit_;
+    // latency without queueing, forgotten every few hundred calls so the
+    // limit follows a slower backend
+    double min_latency_us_ = 0;
+    unsigned int samples_ = 0;
+};
+
+}
+
+#endif // CONCURRENCY_LIMIT_H
@@ -0,0 +1,170 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "handoff.h"
+
+namespace httpserver {
+namespace handoff {
+
+// SCM_MAX_FD is 253, a server has a handful of listeners
+static const int max_fds = 64;
+
+std::vector<int>
+inherited(){
+    std::vector<int> fds;
+
+    const char* count = getenv("LISTEN_FDS");
+    const char* pid = getenv("LISTEN_PID");
+
+    if(count == NULL)
+        return fds;
+
+    if(pid != NULL && atol(pid) != (long) getpid())
+        return fds;
+
+    int size = atoi(count);
+    for(int i = 0; i < size; i++){
+        int fd = 3 + i;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fds.push_back(fd);
+    }
+
+    // not for our children
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_PID");
+
+    return fds;
+}
+
+std::vector<int>
+receive(const char* path){
+    std::vector<int> fds;
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path))
+        return fds;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return fds;
+
+    // an old server that stopped answering must not block our start
+    timeval timeout = { 5, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if(connect(fd, (sockaddr*) &addr, sizeof(addr)) < 0){
+        close(fd);
+        return fds;
+    }
+
+    char data;
+    iovec iov = { &data, 1 };
+    char control[CMSG_SPACE(sizeof(int) * max_fds)];
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if(recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) > 0){
+        for(cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)){
+            if(cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+                continue;
+
+            int size = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for(int i = 0; i < size; i++){
+                int received;
+                memcpy(&received, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+                fds.push_back(received);
+            }
+        }
+    }
+
+    close(fd);
+    return fds;
+}
+
+bool
+send(int socket_fd, const std::vector<int>& fds){
+
+    if(fds.empty() || fds.size() > (std::size_t) max_fds)
+        return false;
+
+    char data = 'L';
+    iovec iov = { &data, 1 };
+    char control[CMSG_SPACE(sizeof(int) * max_fds)];
+    memset(control, 0, sizeof(control));
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+    cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cm), fds.data(), sizeof(int) * fds.size());
+
+    ssize_t n;
+    do {
+        n = sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+    } while(n < 0 && errno == EINTR);
+
+    return n == 1;
+}
+
+bool
+bound_to(int fd, const void* sock_addr){
+
+    sockaddr_storage bound;
+    socklen_t size = sizeof(bound);
+    memset(&bound, 0, sizeof(bound));
+
+    if(getsockname(fd, (sockaddr*) &bound, &size) < 0)
+        return false;
+
+    const sockaddr* wanted = (const sockaddr*) sock_addr;
+    if(bound.ss_family != wanted->sa_family)
+        return false;
+
+    switch(wanted->sa_family){
+    case AF_INET: {
+        const sockaddr_in* a = (const sockaddr_in*) &bound;
+        const sockaddr_in* b = (const sockaddr_in*) wanted;
+        return a->sin_port == b->sin_port
+            && a->sin_addr.s_addr == b->sin_addr.s_addr;
+    }
+    case AF_INET6: {
+        const sockaddr_in6* a = (const sockaddr_in6*) &bound;
+        const sockaddr_in6* b = (const sockaddr_in6*) wanted;
+        return a->sin6_port == b->sin6_port
+            && memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(in6_addr)) == 0;
+    }
+    case AF_UNIX: {
+        const sockaddr_un* a = (const sockaddr_un*) &bound;
+        const sockaddr_un* b = (const sockaddr_un*) wanted;
+        return strncmp(a->sun_path, b->sun_path, sizeof(a->sun_path)) == 0;
+    }
+    default:
+        return false;
+    }
+}
+
+}
+}
@@ -0,0 +1,34 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <vector>
+
+namespace httpserver {
+
+// Passing already listening sockets from a running server to its
+// replacement, so the accept backlog survives a binary upgrade.
+namespace handoff {
+
+// listening fds passed by systemd style socket activation
+// (LISTEN_FDS/LISTEN_PID, starting at fd 3)
+std::vector<int>
+inherited();
+
+// connects to the handoff socket of a running server and receives its
+// listening fds, empty if nobody listens on path
+std::vector<int>
+receive(const char* path);
+
+// sends fds over a connected AF_UNIX socket with SCM_RIGHTS
+bool
+send(int socket_fd, const std::vector<int>& fds);
+
+// true if fd is bound to the same address as sock_addr
+bool
+bound_to(int fd, const void* sock_addr);
+
+}
+
+}
+
+#endif // HANDOFF_H
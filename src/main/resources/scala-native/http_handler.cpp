@@ -8,9 +8,12 @@ namespace httpserver{
 static void
 async_response_callback_wrap(request_t* req, response_t* resp) {
     //std::cout << "async_response_callback_wrap" << std::endl;
-    auto handler = static_cast<http_handler *>(req->handler_);
-    auto callback = handler->callback_response();
-    callback(resp);
+    // the callback belongs to this request, a second answer is ignored
+    std::unique_ptr<std::function<http_handler::callback_t<response_t*>>> callback(
+        static_cast<std::function<http_handler::callback_t<response_t*>> *>(req->handler_));
+    req->handler_ = NULL;
+    if(callback)
+        (*callback)(resp);
 }
 
 http_handler::http_handler(
@@ -39,8 +42,9 @@ response_t* http_handler::dispatch(request_t* req) {
 
 void http_handler::dispatch_async(request_t* req, std::function<callback_t<response_t*>> callback) {
     //std::cout << "dispatch_async" << std::endl;
-    callback_response_ = callback;
-    req->handler_ = this;
+    // owned by the request until the handler answers, the session may be
+    // serving its next request or be gone by then
+    req->handler_ = new std::function<callback_t<response_t*>>(std::move(callback));
     (*http_handler_async_callback_)(req, &async_response_callback_wrap);
 }
 
@@ -4,6 +4,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <functional>
+#include <memory>
 #include <unordered_map>
 #include <string>
 
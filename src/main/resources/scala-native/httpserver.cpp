@@ -18,6 +18,22 @@
 
 
 #include "httpserver.h"
+#include "access_log.h"
+#include "admission.h"
+#include "concurrency_limit.h"
+#include "asio/spawn.hpp"
+#include "asio/stack_pool.hpp"
+#include "handoff.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "proxy_protocol.h"
+#include "rate_limiter.h"
+#include "sendfile.h"
+#include "slow_requests.h"
+#include "timer_wheel.h"
+#include "worker_pool.h"
+#include "zerocopy.h"
+#include "zerocopy_reaper.h"
 
 
 // anticrisis: add namespace
@@ -27,86 +43,834 @@ namespace httpserver
 // anticrisis: add thread_count
 //std::atomic<int> thread_count;
 
+class http_session;
+class http_server;
+class handoff_listener;
+
+// The session and request_on_cancel race to it, whichever runs second
+// finds the callback and runs it
+void cancel_request(request_t* req){
+    __atomic_store_n(&req->cancelled, 1, __ATOMIC_SEQ_CST);
+    request_cancel_callback_t callback = __atomic_exchange_n(
+        &req->on_cancel_, (request_cancel_callback_t) NULL, __ATOMIC_SEQ_CST);
+    if(callback != NULL)
+        callback(req);
+}
+
+// State shared by every listener and session started by one run()
+class server_state {
+
+public:
+
+    server_state(net::io_context& io,
+                 std::shared_ptr<beast_handler_t> handler,
+                 std::shared_ptr<server_opts> opts)
+        :io_(io),
+        drain_timer_(io),
+        handler_(handler),
+        opts_(opts)
+    {
+        if(opts_->rate_limit > 0)
+            rate_limits_.reset(new rate_limiter(
+                opts_->rate_limit, opts_->rate_limit_burst, opts_->rate_limit_clients));
+
+        routes_t* routes = opts_->routes;
+        for(int i = 0; routes != NULL && i < routes->size; i++){
+            const route_t* route = &routes->routes[i];
+            if(route->max_concurrency > 0)
+                limits_[route] = std::make_shared<concurrency_limit>(
+                    route->max_concurrency, route->max_queued);
+        }
+
+        if(opts_->access_log_path != NULL)
+            access_log_.reset(new access_log(opts_->access_log_path, opts_->access_log_level,
+                                             opts_->access_log_sample, opts_->access_log_buffer));
+
+        if(opts_->slow_request_ms > 0)
+            slow_requests_.reset(new slow_requests(opts_->slow_request_ms, opts_->slow_requests_kept));
+
+        if(opts_->histograms_path != NULL){
+            // an HdrHistogram log tag ends at a comma or space
+            for(int i = 0; routes != NULL && i < routes->size; i++){
+                std::string name = routes->routes[i].prefix;
+                std::replace_if(name.begin(), name.end(),
+                    [](char c){ return c == ',' || c == ' ' || c == ':'; }, '_');
+                route_names_.push_back(name);
+            }
+            route_names_.push_back("default");
+            latencies_.reset(new latency_recorder(route_names_.size()));
+        }
+    }
+
+    beast_handler_t* handler(){
+        return handler_.get();
+    }
+
+    server_opts* opts(){
+        return opts_.get();
+    }
+
+    bool draining(){
+        return draining_;
+    }
+
+    void add_server(std::shared_ptr<http_server> server);
+
+    // Listening sockets inherited from a previous process, each is adopted
+    // by the http_server for the endpoint it is bound to
+    void add_listeners(const std::vector<int>& fds);
+
+    int take_listener(const stream_protocol::endpoint& endpoint);
+
+    void close_unused_listeners();
+
+    // fds of every open listener, for handing them to a new process
+    std::vector<int> listener_fds();
+
+    void set_handoff(std::shared_ptr<handoff_listener> handoff);
+
+    // One wheel per io thread, a session always uses the same one
+    void start_timer_wheels(std::size_t count);
+
+    timer_wheel& timer_wheel_for(const void* session){
+        std::size_t h = std::hash<const void*>()(session);
+        return *timer_wheels_[(h >> 4) % timer_wheels_.size()];
+    }
+
+    // NULL unless opts->worker_threads is set
+    worker_pool* workers(){
+        return workers_.get();
+    }
+
+    // NULL unless opts->access_log_path is set
+    access_log* access_logger(){
+        return access_log_.get();
+    }
+
+    // NULL unless opts->slow_request_ms is set
+    slow_requests* slow_log(){
+        return slow_requests_.get();
+    }
+
+    std::string slow_requests_text(){
+        return slow_requests_ ? slow_requests_->text() : std::string();
+    }
+
+    // NULL unless opts->histograms_path is set
+    latency_recorder* latencies(){
+        return latencies_.get();
+    }
+
+    std::string histograms_text(){
+        return latencies_->hdr_log(route_names_);
+    }
+
+    // Index of the route of target in opts->routes, past the last route
+    // for a target outside all of them
+    std::size_t route_index(beast::string_view target){
+        const route_t* route = route_for(target);
+        return route != NULL ? route - opts_->routes->routes : route_names_.size() - 1;
+    }
+
+    // NULL unless opts->rate_limit is set
+    rate_limiter* rate_limits(){
+        return rate_limits_.get();
+    }
+
+    // NULL unless opts->admission_target_ms is set
+    admission_control* admission(){
+        return admission_.get();
+    }
+
+    // Starts the worker pool and the admission control of queued handlers
+    void start_workers();
+
+    void stop_workers();
+
+    void add_session(std::shared_ptr<http_session> session);
+
+    void remove_session(http_session* session);
+
+    // True once max_connections sessions are open, listeners stop
+    // accepting and leave new connections in the kernel backlog
+    bool at_capacity(){
+        return opts_->max_connections > 0 && connections_ >= opts_->max_connections;
+    }
+
+    // Server wide or, for a target under one of opts->routes, the route's
+    // body size limit, 0 is unlimited
+    long unsigned int body_limit(beast::string_view target){
+        const route_t* route = route_for(target);
+        if(route != NULL && route->max_body_size > 0)
+            return route->max_body_size;
+        return opts_->max_body_size;
+    }
+
+    // Server wide or route header limits, 0 is unlimited
+    unsigned int header_size_limit(beast::string_view target){
+        const route_t* route = route_for(target);
+        if(route != NULL && route->max_header_size > 0)
+            return route->max_header_size;
+        return opts_->max_header_size;
+    }
+
+    int header_count_limit(beast::string_view target){
+        const route_t* route = route_for(target);
+        if(route != NULL && route->max_header_count > 0)
+            return route->max_header_count;
+        return opts_->max_header_count;
+    }
+
+    // Server wide or route handler timeout, 0 is unlimited
+    unsigned int handler_timeout(beast::string_view target){
+        const route_t* route = route_for(target);
+        if(route != NULL && route->handler_timeout_ms > 0)
+            return route->handler_timeout_ms;
+        return opts_->handler_timeout_ms;
+    }
+
+    // The PRIORITY_ class of a request, from its route or else from
+    // opts->priority_header; the server's own endpoints are high
+    int priority(const http::request_header<>& header){
+
+        if(native_path(header.target()))
+            return PRIORITY_HIGH;
+
+        const route_t* route = route_for(header.target());
+        if(route != NULL && route->priority != PRIORITY_NORMAL)
+            return route->priority;
+
+        if(opts_->priority_header == NULL)
+            return PRIORITY_NORMAL;
+
+        auto value = header[opts_->priority_header];
+        if(beast::iequals(value, "high"))
+            return PRIORITY_HIGH;
+        if(beast::iequals(value, "low"))
+            return PRIORITY_LOW;
+        return PRIORITY_NORMAL;
+    }
+
+    // Requests the rate limiter lets pass: the server's own endpoints and
+    // high priority routes, never a class a client claimed in a header
+    bool rate_exempt(beast::string_view target){
+        if(native_path(target))
+            return true;
+        const route_t* route = route_for(target);
+        return route != NULL && route->priority == PRIORITY_HIGH;
+    }
+
+    bool native_path(beast::string_view target){
+        return (opts_->liveness_path != NULL && target == opts_->liveness_path)
+            || (opts_->readiness_path != NULL && target == opts_->readiness_path)
+            || (opts_->metrics_path != NULL && target == opts_->metrics_path)
+            || (opts_->histograms_path != NULL && target == opts_->histograms_path)
+            || (opts_->slow_requests_path != NULL && target == opts_->slow_requests_path);
+    }
+
+    // The bulkhead of the route of target, NULL without max_concurrency
+    std::shared_ptr<concurrency_limit> limit_for(beast::string_view target){
+        if(limits_.empty())
+            return NULL;
+        auto it = limits_.find(route_for(target));
+        return it != limits_.end() ? it->second : NULL;
+    }
+
+    // The route with the longest prefix of target
+    const route_t* route_for(beast::string_view target){
+        routes_t* routes = opts_->routes;
+        const route_t* found = NULL;
+        std::size_t found_size = 0;
+
+        if(routes == NULL)
+            return NULL;
+
+        for(int i = 0; i < routes->size; i++){
+            const route_t* route = &routes->routes[i];
+            beast::string_view prefix { route->prefix };
+            if(target.substr(0, prefix.size()) == prefix && (found == NULL || prefix.size() > found_size)){
+                found = route;
+                found_size = prefix.size();
+            }
+        }
+        return found;
+    }
+
+    // Counts requests refused by the limits or opts->precheck, and those
+    // answered for the handler
+    void rejected(http::status status){
+        if(status == http::status::payload_too_large)
+            rejected_bodies_++;
+        else if(status == http::status::request_header_fields_too_large)
+            rejected_headers_++;
+        else if(status == http::status::service_unavailable)
+            rejected_busy_++;
+        else if(status == http::status::gateway_timeout)
+            handler_timeouts_++;
+        else if(status == http::status::too_many_requests)
+            rate_limited_++;
+        else
+            rejected_prechecks_++;
+    }
+
+    // Counts requests shed by admission control
+    void shed(){
+        shed_++;
+    }
+
+    // Counts requests whose client disconnected before the handler answered
+    void cancelled(){
+        cancelled_++;
+    }
+
+    // The counters of every thread and of the server in the Prometheus
+    // text format
+    std::string metrics_text();
+
+    // Counts a listener pausing, resuming adds the time it spent paused
+    void accept_paused();
+
+    void accept_resumed(std::chrono::steady_clock::duration paused);
+
+    // Stops accepting, closes idle keep-alive sessions and lets the others
+    // finish their current request with "Connection: close". The io_context
+    // stops when the last session ends or drain_timeout_ms passes.
+    void drain();
+
+    void stop();
+
+private:
+    net::io_context& io_;
+    net::steady_timer drain_timer_;
+    std::shared_ptr<beast_handler_t> handler_;
+    std::shared_ptr<server_opts> opts_;
+    std::atomic<bool> draining_{false};
+    std::atomic<bool> stopped_{false};
+    std::atomic<unsigned int> connections_{0};
+    std::atomic<unsigned int> paused_listeners_{0};
+    std::atomic<std::uint64_t> accept_pauses_{0};
+    std::atomic<std::uint64_t> accept_paused_us_{0};
+    std::atomic<std::uint64_t> rejected_headers_{0};
+    std::atomic<std::uint64_t> rejected_bodies_{0};
+    std::atomic<std::uint64_t> rejected_prechecks_{0};
+    std::atomic<std::uint64_t> rejected_busy_{0};
+    std::atomic<std::uint64_t> handler_timeouts_{0};
+    std::atomic<std::uint64_t> cancelled_{0};
+    std::atomic<std::uint64_t> shed_{0};
+    std::atomic<std::uint64_t> rate_limited_{0};
+    std::mutex mutex_;
+    std::vector<std::weak_ptr<http_server>> servers_;
+    std::vector<int> listeners_;
+    std::weak_ptr<handoff_listener> handoff_;
+    std::vector<std::unique_ptr<timer_wheel>> timer_wheels_;
+    std::unique_ptr<worker_pool> workers_;
+    std::unique_ptr<admission_control> admission_;
+    std::unique_ptr<rate_limiter> rate_limits_;
+    std::unique_ptr<latency_recorder> latencies_;
+    std::unique_ptr<access_log> access_log_;
+    std::unique_ptr<slow_requests> slow_requests_;
+    std::vector<std::string> route_names_;
+    std::unordered_map<const route_t*, std::shared_ptr<concurrency_limit>> limits_;
+    std::unordered_map<http_session*, std::weak_ptr<http_session>> sessions_;
+};
+
 //------------------------------------------------------------------------------
-class http_session : public std::enable_shared_from_this<http_session>{
+class http_session : public std::enable_shared_from_this<http_session>,
+                     public timer_wheel_entry {
 
 public:
 
-    http_session(tcp::socket&& socket,
-                 std::unique_ptr<http_handler> handler_ptr)
-        :stream_(std::move(socket)),
+    http_session(stream_protocol::socket&& socket,
+                 std::unique_ptr<http_handler> handler_ptr,
+                 std::shared_ptr<server_state> state,
+                 std::shared_ptr<http_server> server)
+        :socket_(std::move(socket)),
         //deadline_timer_(socket),
-        http_handler_(std::move(handler_ptr))
+        http_handler_(std::move(handler_ptr)),
+        state_(state),
+        server_(server),
+        timers_(state->timer_wheel_for(this))
     {
     }
 
-    tcp::socket& socket(){
-        return this->stream_.socket();
+    ~http_session();
+
+    stream_protocol::socket& socket(){
+        return this->socket_;
     }
 
     void run(){
+        state_->add_session(this->shared_from_this());
+        thread_metrics::add(metrics::local().connections_opened);
+
         net::dispatch(
-            stream_.get_executor(),
+            socket_.get_executor(),
             beast::bind_front_handler(
-                &http_session::do_read,
+                &http_session::start,
                 this->shared_from_this()));
     }
 
+    // Called on drain, a session blocked waiting for its next request is
+    // closed now, one with a request in progress closes after responding
+    void close_if_idle(){
+        net::dispatch(
+            socket_.get_executor(),
+            [self = this->shared_from_this()]() {
+                if(self->idle_){
+                    beast::error_code ec;
+                    self->socket_.shutdown(stream_protocol::socket::shutdown_both, ec);
+                    self->close_socket();
+                }
+            });
+    }
+
+    void on_timeout(std::uint64_t generation) override {
+        net::dispatch(
+            socket_.get_executor(),
+            [self = this->shared_from_this(), generation]() {
+                // a later phase replaced the deadline that fired
+                if(generation != self->timer_generation_)
+                    return;
+                if(self->call_)
+                    return self->handler_timed_out();
+                thread_metrics::add(metrics::local().timeouts);
+                self->abort();
+            });
+    }
+
+    std::shared_ptr<timer_wheel_entry> timeout_ref() override {
+        return weak_from_this().lock();
+    }
+
 
     // Handles an HTTP server connection
     void do_read(){
 
+        if(state_->draining())
+            return do_close();
+
         req_ = {};
-        stream_.expires_after(std::chrono::seconds(5));
+        parser_.emplace();
+
+        // Between requests wait for the first byte under the keep-alive
+        // idle timeout, the header timeout starts once the client talks
+        if(requests_ > 0 && buffer_.size() == 0){
+            idle_ = true;
+            expires_after(state_->opts()->keepalive_timeout_ms);
+
+            return socket_.async_wait(
+                stream_protocol::socket::wait_read,
+                beast::bind_front_handler(
+                    &http_session::on_readable,
+                    shared_from_this()));
+        }
+
+        read_header();
+    }
+
+private:
 
-        std::cout << "new connection" << std::endl;
+    // The addresses are taken once per connection and only formatted if
+    // the handler asks, see address_format
+    void start(){
 
-        http::async_read(
-            stream_,
-            buffer_,
-            req_,
+        beast::error_code ec;
+        to_address(socket_.remote_endpoint(ec), peer_address_);
+        to_address(socket_.local_endpoint(ec), local_address_);
+        client_address_ = peer_address_;
+
+        if(peer_address_.family == AF_UNIX){
+            socklen_t size = sizeof(peer_credentials_);
+            ::getsockopt(socket_.native_handle(), SOL_SOCKET, SO_PEERCRED, &peer_credentials_, &size);
+        }
+
+        if(state_->opts()->proxy_protocol)
+            return read_proxy_header();
+
+        do_read();
+    }
+
+    static void to_address(const stream_protocol::endpoint& endpoint, address_t& address){
+
+        address = {};
+        address.family = endpoint.data()->sa_family;
+
+        if(address.family == AF_INET){
+            auto in = reinterpret_cast<const sockaddr_in*>(endpoint.data());
+            std::memcpy(address.addr, &in->sin_addr, 4);
+            address.port = ntohs(in->sin_port);
+        } else if(address.family == AF_INET6){
+            auto in6 = reinterpret_cast<const sockaddr_in6*>(endpoint.data());
+            std::memcpy(address.addr, &in6->sin6_addr, 16);
+            address.port = ntohs(in6->sin6_port);
+        }
+    }
+
+    // The header may arrive in pieces, whatever follows it stays in
+    // buffer_ for the HTTP parser
+    void read_proxy_header(){
+
+        expires_after(state_->opts()->header_timeout_ms);
+
+        socket_.async_read_some(
+            buffer_.prepare(512),
             beast::bind_front_handler(
-                &http_session::on_read,
+                &http_session::on_proxy_header,
                 shared_from_this()));
     }
 
-private:
+    void on_proxy_header(beast::error_code ec, std::size_t bytes_transferred){
+
+        if(ec == net::error::eof)
+            return do_close();
 
-    void on_read(
+        if(ec)
+            return fail(ec, "read");
+
+        buffer_.commit(bytes_transferred);
+
+        proxy_protocol::header header;
+        auto data = buffer_.cdata();
+        int length = proxy_protocol::parse(
+            static_cast<const char*>(data.data()), data.size(), header);
+
+        if(length == 0)
+            return read_proxy_header();
+
+        if(length < 0){
+            std::cerr << "read: invalid PROXY protocol header\n";
+            return do_close();
+        }
+
+        buffer_.consume(length);
+
+        if(!header.local){
+            client_address_ = header.source;
+            local_address_ = header.destination;
+        }
+
+        do_read();
+    }
+
+    void on_readable(beast::error_code ec){
+
+        idle_ = false;
+
+        if(ec)
+            return fail(ec, "read");
+
+        read_header();
+    }
+
+    void read_header(){
+
+        server_opts* opts = state_->opts();
+
+        timing_ = {};
+        timing_.read_start = std::chrono::steady_clock::now();
+        access_.verb = http::verb::unknown;
+        access_.target_size = 0;
+        access_.bytes_in = 0;
+        access_.bytes_out = 0;
+
+        expires_after(opts->header_timeout_ms);
+
+        if(opts->max_header_size > 0)
+            parser_->header_limit(opts->max_header_size);
+
+        // the route is only known once the header is in, checked there
+        // (not boost::none, older beast compares a length against it)
+        parser_->body_limit((std::numeric_limits<std::uint64_t>::max)());
+
+        http::async_read_header(
+            socket_,
+            buffer_,
+            *parser_,
+            beast::bind_front_handler(
+                &http_session::on_header,
+                shared_from_this()));
+    }
+
+    void on_header(
         beast::error_code ec,
         std::size_t bytes_transferred)
     {
-        boost::ignore_unused(bytes_transferred);
+        thread_metrics::add(metrics::local().bytes_in, bytes_transferred);
+        access_.bytes_in += bytes_transferred;
 
         // This means they closed the connection
         if(ec == http::error::end_of_stream)
             return do_close();
 
+        if(ec == http::error::header_limit)
+            return reject(http::status::request_header_fields_too_large, "Request header too large");
+
+        if(ec)
+            return fail(ec, "read");
+
+        header_received_ = std::chrono::steady_clock::now();
+        timing_.header = header_received_;
+
+        auto& header = parser_->get();
+
+        priority_ = state_->priority(header);
+
+        if(state_->access_logger() != NULL || state_->slow_log() != NULL){
+            auto target = header.target();
+            access_.verb = header.method();
+            access_.target_size = std::min(target.size(), sizeof(access_.target));
+            std::memcpy(access_.target, target.data(), access_.target_size);
+        }
+
+        if(!state_->rate_exempt(header.target()) && rate_limited(header))
+            return;
+
+        // the parser only knows the server wide size limit, the size of
+        // the header is what it consumed
+        unsigned int header_size = state_->header_size_limit(header.target());
+        if(header_size > 0 && bytes_transferred > header_size)
+            return reject(http::status::request_header_fields_too_large, "Request header too large");
+
+        int header_count = state_->header_count_limit(header.target());
+        if(header_count > 0 && std::distance(header.begin(), header.end()) > header_count)
+            return reject(http::status::request_header_fields_too_large, "Too many request headers");
+
+        // Refuse a declared length before reading any of the body, a
+        // chunked body fails in read_body once it passes the limit
+        long unsigned int body_limit = state_->body_limit(header.target());
+        if(body_limit > 0){
+            if(parser_->content_length() && *parser_->content_length() > body_limit)
+                return reject(http::status::payload_too_large, "Request body too large");
+            parser_->body_limit(body_limit);
+        }
+
+        if(parser_->is_done())
+            return on_read();
+
+        // an HTTP/1.0 client does not know interim responses
+        if(header.version() >= 11 && beast::iequals(header[http::field::expect], "100-continue"))
+            return send_continue();
+
+        body_started_ = std::chrono::steady_clock::now();
+        body_read_ = 0;
+        read_body();
+    }
+
+    // Charges the request to its client's token bucket, an empty bucket
+    // answers 429 before the body is read or anything is copied
+    bool rate_limited(const http::request_header<>& header){
+
+        rate_limiter* limits = state_->rate_limits();
+        if(limits == NULL)
+            return false;
+
+        std::uint64_t wait_ms;
+        const char* name = state_->opts()->rate_limit_header;
+        auto key = name != NULL ? header[name] : beast::string_view();
+
+        if(!key.empty())
+            wait_ms = limits->acquire(key.data(), key.size());
+        else if(client_address_.family == AF_UNIX)
+            // no address, every local client would share one bucket
+            wait_ms = limits->acquire(&peer_credentials_, sizeof(peer_credentials_));
+        else
+            wait_ms = limits->acquire(client_address_.addr, sizeof(client_address_.addr));
+
+        if(wait_ms == 0)
+            return false;
+
+        cancel_deadline();
+        state_->rejected(http::status::too_many_requests);
+
+        // a request without a body is read to the end, the client may go on
+        http::response<http::string_body> res{ http::status::too_many_requests, header.version() };
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/plain");
+        res.set(http::field::retry_after, std::to_string((wait_ms + 999) / 1000));
+        res.keep_alive(parser_->is_done() && parser_->keep_alive() && !state_->draining());
+        res.body() = "Too many requests";
+        res.prepare_payload();
+        send_response(std::move(res));
+        return true;
+    }
+
+    // The client waits for an interim response before sending its body.
+    // The limits above already passed, opts->precheck may still refuse the
+    // request from its header alone, so refused bodies never travel.
+    void send_continue(){
+
+        auto& header = parser_->get();
+        http_precheck_callback_t precheck = state_->opts()->precheck;
+
+        if(precheck != NULL){
+            request_storage storage;
+            request_t* request = new_request(header, storage);
+            int status = precheck(request);
+            request_free(request);
+
+            if(status != 0)
+                return reject(static_cast<http::status>(status), "Request refused");
+        }
+
+        auto res = std::make_shared<http::response<http::empty_body>>(
+            http::status::continue_, header.version());
+
+        expires_after(state_->opts()->write_timeout_ms);
+
+        http::async_write(
+            socket_,
+            *res,
+            [self = shared_from_this(), res](beast::error_code ec, std::size_t) {
+                if(ec)
+                    return self->fail(ec, "write");
+
+                self->body_started_ = std::chrono::steady_clock::now();
+                self->body_read_ = 0;
+                self->read_body();
+            });
+    }
+
+    // The body deadline grows with the bytes received: a client has
+    // body_timeout_ms plus one second per body_min_rate bytes, so slow
+    // but steady uploads pass and trickling ones do not. Without a rate
+    // body_timeout_ms applies between reads.
+    void read_body(){
+
+        server_opts* opts = state_->opts();
+
+        if(opts->body_min_rate > 0){
+            auto allowed = std::chrono::milliseconds(opts->body_timeout_ms)
+                + std::chrono::milliseconds(body_read_ * 1000 / opts->body_min_rate);
+            deadline(body_started_ + allowed);
+        } else {
+            expires_after(opts->body_timeout_ms);
+        }
+
+        http::async_read_some(
+            socket_,
+            buffer_,
+            *parser_,
+            beast::bind_front_handler(
+                &http_session::on_body,
+                shared_from_this()));
+    }
+
+    void on_body(
+        beast::error_code ec,
+        std::size_t bytes_transferred)
+    {
+        if(ec == http::error::body_limit)
+            return reject(http::status::payload_too_large, "Request body too large");
+
         if(ec)
             return fail(ec, "read");
 
+        thread_metrics::add(metrics::local().bytes_in, bytes_transferred);
+        access_.bytes_in += bytes_transferred;
+        body_read_ += bytes_transferred;
+
+        if(!parser_->is_done())
+            return read_body();
+
+        on_read();
+    }
+
+    void on_read()
+    {
+        cancel_deadline();
+
+        requests_++;
+        thread_metrics::add(metrics::local().requests);
+        timing_.read_done = std::chrono::steady_clock::now();
+
+        req_ = parser_->release();
+        keep_alive_ = req_.keep_alive();
+
         // Send the response
         handle_request(std::move(req_));
     }
 
+    // Arms the session deadline on the timer wheel, 0 disables it
+    void expires_after(unsigned int ms){
+        if(ms == 0)
+            return cancel_deadline();
+        deadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(ms));
+    }
+
+    void deadline(std::chrono::steady_clock::time_point at){
+        timer_generation_ = timers_.schedule(this, at);
+    }
+
+    void cancel_deadline(){
+        timers_.cancel(this);
+        timer_generation_ = 0;
+    }
+
+    // Keep the connection open after this response, unless the client
+    // asked otherwise or the server is draining
+    bool keep_alive(){
+        return keep_alive_ && !state_->draining();
+    }
+
     void abort(){
-        stream_.socket().cancel();
-        stream_.close();
-        //stream_.socket().close();
+        beast::error_code ec;
+        socket_.cancel(ec);
+        close_socket();
+        //socket_.close();
     }
 
-    // Returns a bad request response
-    http::message_generator bad_request(beast::string_view why) {
-        http::response<http::string_body> res{ http::status::bad_request,
-                                              req_.version() };
+    // The kernel may still read zerocopy bodies, those pending and one
+    // whose send was cancelled, their completions come on this socket's
+    // error queue: while any send is not reported complete the connection
+    // is only shut down, the destructor hands the socket to a reaper
+    void close_socket(){
+        closing_ = true;
+        beast::error_code ec;
+        if(zerocopy_sent_ == zerocopy_completed_)
+            socket_.close(ec);
+        else
+            socket_.shutdown(stream_protocol::socket::shutdown_both, ec);
+    }
+
+    // Returns a plain text response, the connection stays open
+    http::response<http::string_body> error_response(http::status status, beast::string_view why) {
+        http::response<http::string_body> res{ status, req_.version() };
         res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
         res.set(http::field::content_type, "text/plain");
-        res.keep_alive(req_.keep_alive());
+        res.keep_alive(keep_alive());
         res.body() = std::string(why);
         res.prepare_payload();
         return res;
     }
 
+    // A 503 the client may retry, after the second it takes queues to move
+    http::response<http::string_body> busy_response(beast::string_view why) {
+        auto res = error_response(http::status::service_unavailable, why);
+        res.set(http::field::retry_after, "1");
+        return res;
+    }
+
+    // Returns a bad request response
+    http::response<http::string_body> bad_request(beast::string_view why) {
+        return error_response(http::status::bad_request, why);
+    }
+
+    // Answers a request that is not read to the end, the rest of it is
+    // still on the socket so the connection closes after the response
+    void reject(http::status status, beast::string_view why) {
+
+        cancel_deadline();
+        state_->rejected(status);
+
+        http::response<http::string_body> res{ status, parser_->get().version() ? parser_->get().version() : 11 };
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/plain");
+        res.keep_alive(false);
+        res.body() = std::string(why);
+        res.prepare_payload();
+        send_response(std::move(res));
+    }
+
     void send_body(int status,
                    tl::optional<std::unordered_map<std::string, std::string>>&& headers,
                    std::string&&            body,
@@ -120,7 +884,7 @@ private:
             for (auto& kv: *headers)
                 res.base().set(kv.first, std::move(kv.second));
         res.body() = std::move(body);
-        res.keep_alive(req_.keep_alive());
+        res.keep_alive(keep_alive());
         res.prepare_payload();
         send_response(std::move(res));
     }
@@ -156,9 +920,10 @@ private:
                 auto sbody = std::string { body->body };
                 res.body() = std::move(sbody);
             }
+            release_body(body);
         }
 
-        res.keep_alive(req_.keep_alive());
+        res.keep_alive(keep_alive());
         res.prepare_payload();
         send_response(std::move(res));
     }
@@ -188,29 +953,328 @@ private:
         res.body().data = (char *)response->body->body_raw;
         res.body().size = response->body->size;
 
-        res.keep_alive(req_.keep_alive());
+        // body_raw is written straight from handler memory
+        write_body_ = response->body;
+
+        res.keep_alive(keep_alive());
         res.prepare_payload();
         send_response(std::move(res));
     }
 
+    // Writes only the header of the response through beast, the caller
+    // sends the body->size bytes of the body once on_header runs
+    template <class Handler>
+    void write_header(response_t* response, Handler&& on_header) {
+
+        auto res = std::make_shared<http::response<http::empty_body>>(
+            static_cast<http::status>(response->status_code), req_.version());
+
+        res->set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res->set(http::field::content_type, response->content_type);
+
+        headers_t* headers = response->headers;
+
+        if(headers != NULL){
+            int size = headers->size;
+            header_t* hs = headers->headers;
+            for(int i = 0; i < size; i++){
+                res->base().set(hs->name, hs->value);
+                hs++;
+            }
+        }
+
+        // no prepare_payload, it would set the empty_body length
+        res->content_length(response->body->size);
+        res->keep_alive(keep_alive());
+
+        auto sr = std::make_shared<http::response_serializer<http::empty_body>>(*res);
+        bool keep_alive = res->keep_alive();
+
+        access_.status = response->status_code;
+        access_.bytes_out = 0;
+        metrics::local().response(response->status_code);
+        timing_.write_start = std::chrono::steady_clock::now();
+
+        http::async_write_header(
+            socket_,
+            *sr,
+            [this, res, sr, keep_alive, on_header = std::forward<Handler>(on_header)](
+                beast::error_code ec, std::size_t bytes_transferred) mutable {
+                thread_metrics::add(metrics::local().bytes_out, bytes_transferred);
+                access_.bytes_out = bytes_transferred;
+                on_header(ec, keep_alive);
+            });
+    }
+
+    // Writes the header through beast, then hands body_raw to the kernel
+    // with MSG_ZEROCOPY. The body is released once the error queue reports
+    // its last send as complete, which can be after the next request.
+    void create_zerocopy_response(response_t* response) {
+
+        body_t* body = response->body;
+
+        write_header(
+            response,
+            [self = shared_from_this(), body](beast::error_code ec, bool keep_alive) {
+                if(ec){
+                    self->release_body(body);
+                    return self->fail(ec, "write");
+                }
+                self->send_zerocopy(body, 0, keep_alive);
+            });
+    }
+
+    // Streams body->size bytes of body->fd from body->offset with sendfile,
+    // the file is never read into user space. The fd is closed once sent.
+    void create_file_response(response_t* response) {
+
+        body_t* body = response->body;
+
+        beast::error_code ec;
+        socket_.native_non_blocking(true, ec);
+        if(ec){
+            close_file(body);
+            return fail(ec, "write");
+        }
+
+        write_header(
+            response,
+            [self = shared_from_this(), body](beast::error_code ec, bool keep_alive) {
+                if(ec){
+                    self->close_file(body);
+                    return self->fail(ec, "write");
+                }
+                self->send_file(body, 0, keep_alive);
+            });
+    }
+
+    void send_file(body_t* body, std::size_t offset, bool keep_alive){
+
+        int fd = socket_.native_handle();
+
+        while(offset < body->size){
+            ssize_t n = sendfile::send(fd, body->fd, body->offset + offset, body->size - offset);
+
+            if(n < 0 && errno == EINTR)
+                continue;
+
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                socket_.async_wait(
+                    stream_protocol::socket::wait_write,
+                    [self = shared_from_this(), body, offset, keep_alive](
+                        beast::error_code ec) {
+                        if(ec){
+                            self->close_file(body);
+                            return self->fail(ec, "write");
+                        }
+                        self->send_file(body, offset, keep_alive);
+                    });
+                return;
+            }
+
+            if(n <= 0){
+                // a file shorter than body->size leaves the response truncated,
+                // the connection can not be reused
+                beast::error_code ec = n < 0
+                    ? beast::error_code(errno, net::error::get_system_category())
+                    : beast::error_code(net::error::eof);
+                close_file(body);
+                fail(ec, "sendfile");
+                return do_close();
+            }
+
+            offset += n;
+        }
+
+        close_file(body);
+        on_write(keep_alive, {}, body->size);
+    }
+
+    void close_file(body_t* body){
+        ::close(body->fd);
+        body->fd = -1;
+        release_body(body);
+    }
+
+    void send_zerocopy(body_t* body, std::size_t offset, bool keep_alive){
+
+        int fd = socket_.native_handle();
+
+        while(offset < body->size){
+            ssize_t n = zerocopy::send(fd, body->body_raw + offset, body->size - offset);
+
+            if(n < 0){
+                if(errno == EINTR)
+                    continue;
+
+                if(errno == EAGAIN || errno == EWOULDBLOCK){
+                    socket_.async_wait(
+                        stream_protocol::socket::wait_write,
+                        [self = shared_from_this(), body, offset, keep_alive](
+                            beast::error_code ec) {
+                            if(ec){
+                                self->abandon_zerocopy(body, offset);
+                                return self->fail(ec, "write");
+                            }
+                            self->send_zerocopy(body, offset, keep_alive);
+                        });
+                    return;
+                }
+
+                if(errno == ENOBUFS && offset == 0){
+                    // optmem_max exhausted by pending notifications, copy instead
+                    zerocopy_failed_ = true;
+                    return send_copy(body, keep_alive);
+                }
+
+                beast::error_code ec(errno, net::error::get_system_category());
+                abandon_zerocopy(body, offset);
+                return fail(ec, "write");
+            }
+
+            offset += n;
+            zerocopy_sent_++;
+        }
+
+        zerocopy_pending_.push_back({zerocopy_sent_, body});
+        wait_zerocopy_completions();
+
+        on_write(keep_alive, {}, body->size);
+    }
+
+    // A failed send may still have chunks of body in flight, which the
+    // kernel reads until it reports them complete
+    void abandon_zerocopy(body_t* body, std::size_t offset){
+        if(offset == 0)
+            return release_body(body);
+        zerocopy_pending_.push_back({zerocopy_sent_, body});
+        wait_zerocopy_completions();
+    }
+
+    // Plain async_write of the remaining body once the header is out
+    void send_copy(body_t* body, bool keep_alive){
+        net::async_write(
+            socket_,
+            net::buffer(body->body_raw, body->size),
+            [self = shared_from_this(), body, keep_alive](
+                beast::error_code ec, std::size_t bytes_transferred) {
+                self->release_body(body);
+                self->on_write(keep_alive, ec, bytes_transferred);
+            });
+    }
+
+    void wait_zerocopy_completions(){
+
+        // a closing session leaves the rest to the reaper
+        if(zerocopy_waiting_ || closing_)
+            return;
+
+        // the reactor is edge triggered and never tries a wait before
+        // queueing it, a notification already there would find no waiter
+        if(!reap_zerocopy_completions() || zerocopy_pending_.empty())
+            return;
+
+        zerocopy_waiting_ = true;
+
+        // completions surface as EPOLLERR on the socket
+        socket_.async_wait(
+            stream_protocol::socket::wait_error,
+            beast::bind_front_handler(
+                &http_session::on_zerocopy_completion,
+                shared_from_this()));
+    }
+
+    void on_zerocopy_completion(beast::error_code ec){
+
+        zerocopy_waiting_ = false;
+
+        // stop_watching cancels every wait on the socket, this one too;
+        // on other errors the destructor hands the rest to a reaper
+        if(ec && ec != net::error::operation_aborted)
+            return;
+
+        wait_zerocopy_completions();
+    }
+
+    // Releases the bodies whose sends all completed, false on a socket
+    // error
+    bool reap_zerocopy_completions(){
+
+        if(!zerocopy::read_completions(socket_.native_handle(), zerocopy_completed_))
+            return false;
+
+        while(!zerocopy_pending_.empty()
+              && static_cast<std::int32_t>(zerocopy_completed_ - zerocopy_pending_.front().first) >= 0){
+            release_body(zerocopy_pending_.front().second);
+            zerocopy_pending_.pop_front();
+        }
+        return true;
+    }
+
+    bool use_zerocopy(body_t* body){
+
+        server_opts* opts = state_->opts();
+
+        if(opts->zerocopy_threshold == 0 || body->size < opts->zerocopy_threshold)
+            return false;
+
+        if(zerocopy_failed_)
+            return false;
+
+        if(!zerocopy_enabled_){
+            int fd = socket_.native_handle();
+            beast::error_code ec;
+            socket_.native_non_blocking(true, ec);
+            if(ec || !zerocopy::enable(fd)){
+                zerocopy_failed_ = true;
+                return false;
+            }
+            zerocopy_enabled_ = true;
+        }
+
+        return true;
+    }
+
+    void release_body(body_t* body){
+        if(body != NULL && body->release != NULL)
+            body->release(body->body_raw, body->size);
+    }
+
     void send_response_t(response_t* response) {
 
-        bool body_bytes = response->body->body_raw != NULL;
+        expires_after(state_->opts()->write_timeout_ms);
+
+        bool body_file = response->body != NULL && response->body->fd >= 0;
+        bool body_bytes = response->body != NULL && response->body->body_raw != NULL;
 
-        if(body_bytes)
+        if(body_file)
+            create_file_response(response);
+        else if(body_bytes && use_zerocopy(response->body))
+            create_zerocopy_response(response);
+        else if(body_bytes)
             create_buffer_response(response);
         else
             create_string_response(response);
     }
 
-    //template <bool isRequest, class Body, class Fields>
-    void send_response(http::message_generator&& msg)
+    template <class Body>
+    void send_response(http::response<Body>&& res)
+    {
+        access_.status = res.result_int();
+        metrics::local().response(res.result_int());
+        write_message(std::move(res));
+    }
+
+    void write_message(http::message_generator&& msg)
     {
+        timing_.write_start = std::chrono::steady_clock::now();
 
         bool keep_alive = msg.keep_alive();
 
+        expires_after(state_->opts()->write_timeout_ms);
+
         beast::async_write(
-            stream_,
+            socket_,
             std::move(msg),
             beast::bind_front_handler(
                 &http_session::on_write, shared_from_this(), keep_alive));
@@ -221,7 +1285,19 @@ private:
         beast::error_code ec,
         std::size_t bytes_transferred)
     {
-        boost::ignore_unused(bytes_transferred);
+        thread_metrics::add(metrics::local().bytes_out, bytes_transferred);
+
+        release_body(write_body_);
+        write_body_ = NULL;
+
+        access_.bytes_out += bytes_transferred;
+        log_access();
+        capture_slow();
+
+        if(timing_.handled)
+            record_latencies();
+
+        cancel_deadline();
 
         if(ec)
             return fail(ec, "write");
@@ -233,6 +1309,84 @@ private:
             return do_close();
         }
 
+        // Read another request
+        do_read();
+    }
+
+    // The phases of a request answered by its handler
+    void record_latencies(){
+
+        timing_.handled = false;
+
+        latency_recorder* latencies = state_->latencies();
+        if(latencies == NULL)
+            return;
+
+        auto now = std::chrono::steady_clock::now();
+        std::size_t route = timing_.route;
+        latencies->record(route, latency_recorder::header, timing_.header - timing_.read_start);
+        latencies->record(route, latency_recorder::body, timing_.read_done - timing_.header);
+        latencies->record(route, latency_recorder::convert, timing_.converted - timing_.read_done);
+        latencies->record(route, latency_recorder::queue, timing_.handler_start - timing_.converted);
+        latencies->record(route, latency_recorder::handler, timing_.handler_done - timing_.handler_start);
+        latencies->record(route, latency_recorder::serialize, timing_.write_start - timing_.handler_done);
+        latencies->record(route, latency_recorder::write, now - timing_.write_start);
+        latencies->record(route, latency_recorder::total, now - timing_.read_start);
+    }
+
+    void log_access(){
+
+        access_log* log = state_->access_logger();
+        if(log == NULL || !log->wanted(access_.status))
+            return;
+
+        auto duration = std::chrono::steady_clock::now() - timing_.read_start;
+        access_.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        access_.duration_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        access_.client = client_address_;
+        log->append(access_);
+    }
+
+    // Keeps the request with the time of each of its phases if it took
+    // longer than opts->slow_request_ms
+    void capture_slow(){
+
+        slow_requests* slow = state_->slow_log();
+        if(slow == NULL)
+            return;
+
+        auto now = std::chrono::steady_clock::now();
+        if(now - timing_.read_start < slow->threshold())
+            return;
+
+        // a phase that did not happen has no end, or no start
+        auto between = [](std::chrono::steady_clock::time_point from,
+                          std::chrono::steady_clock::time_point to) -> std::uint32_t {
+            if(from == std::chrono::steady_clock::time_point() || to < from)
+                return 0;
+            return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+        };
+
+        slow_request r = {};
+        r.request = access_;
+        r.request.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        r.request.duration_us = between(timing_.read_start, now);
+        r.request.client = client_address_;
+        r.header_us = between(timing_.read_start, timing_.header);
+        r.body_us = between(timing_.header, timing_.read_done);
+        r.convert_us = between(timing_.read_done, timing_.converted);
+        if(timing_.handled){
+            r.queue_us = between(timing_.converted, timing_.handler_start);
+            r.handler_us = between(timing_.handler_start, timing_.handler_done);
+            r.serialize_us = between(timing_.handler_done, timing_.write_start);
+        }
+        r.write_us = between(timing_.write_start, now);
+        r.connection_age_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - connected_).count();
+        r.connection_requests = requests_;
+        r.thread = ::syscall(SYS_gettid);
+        slow->add(r);
     }
 
     void do_close()
@@ -240,7 +1394,7 @@ private:
 
         // Send a TCP shutdown
         beast::error_code ec;
-        stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+        socket_.shutdown(stream_protocol::socket::shutdown_send, ec);
 
         //deadline_timer_.cancel();
 
@@ -277,6 +1431,60 @@ private:
     }
 
 
+    // What a request_t points into, kept until the next request or, after
+    // a 504, until the late answer
+    struct request_storage {
+        std::string verb;
+        std::string target;
+        std::string body;
+        std::vector<std::pair<std::string, std::string>> headers;
+        address_t client;
+        address_t local;
+        address_t peer;
+    };
+
+    // Builds the request_t handed to the handler from a parsed header,
+    // without a body
+    request_t* new_request(const http::request_header<>& header, request_storage& storage){
+
+        storage.verb = get_verb(header.method());
+        storage.target = std::string { header.target().data(), header.target().size() };
+        storage.headers.clear();
+
+        for (auto const& kv: header){
+            storage.headers.push_back({
+                std::string{ kv.name_string().data(), kv.name_string().size() },
+                std::string{ kv.value().data(), kv.value().size() }});
+        }
+
+        request_t* request = request_new(storage.verb.c_str(), storage.target.c_str());
+        storage.client = client_address_;
+        storage.local = local_address_;
+        storage.peer = peer_address_;
+        request->client = &storage.client;
+        request->local = &storage.local;
+        request->peer = &storage.peer;
+
+        int hsize = storage.headers.size();
+        if(hsize > 0){
+            request->headers = headers_new(hsize);
+            header_t* headers = (header_t*) malloc(sizeof(header_t)*hsize);
+
+            for(int i = 0; i < hsize; i++){
+                auto& kv = storage.headers[i];
+                headers[i].name = kv.first.c_str();
+                headers[i].value = kv.second.c_str();
+
+                if(beast::iequals(kv.first, "Content-Type"))
+                    request->content_type = kv.second.c_str();
+            }
+
+            request->headers->headers = headers;
+        }
+
+        return request;
+    }
+
     // This function produces an HTTP response for the given
     // request. The type of the response object depends on the
     // contents of the request, so the interface requires the
@@ -287,63 +1495,339 @@ private:
     void handle_request(http::request<Body, http::basic_fields<Allocator>>&& req)
     {
 
-        std::string verb = get_verb(req.method());
+        std::string verb = get_verb(req.method());
+
+        if(verb.empty()){
+            return send_response(bad_request("Unknown HTTP-method"));
+        }
+
+        //auto body_data = req.body().data();
+        //const auto buffer_bytes = buffer_.cdata();
+
+
+        //const char* body_raw = static_cast<const char*>(buffer_bytes.data());
+
+        if(native_endpoint(req.target()))
+            return;
+
+        // refused before any copy is made for the handler
+        admission_control* admission = state_->admission();
+        if(admission != NULL && !admission->admit(priority_)){
+            state_->shed();
+            return send_response(busy_response("Server overloaded"));
+        }
+
+        // the previous request is answered, the handler is done with it
+        if(request_ != NULL)
+            request_free(request_);
+
+        // a timed out handler may still hold the previous storage
+        if(!request_storage_)
+            request_storage_.reset(new request_storage);
+
+        request_t* request = new_request(req.base(), *request_storage_);
+        request->priority = priority_;
+        request_ = request;
+
+        request_storage_->body = std::move(req.body());
+        int body_size = request_storage_->body.size();
+
+        if(body_size > 0){
+            body_t* body = body_new(request_storage_->body.c_str(), NULL, body_size);
+            request->body = body;
+        }
+
+        timing_.converted = std::chrono::steady_clock::now();
+        if(state_->latencies() != NULL)
+            timing_.route = state_->route_index(req.target());
+
+        // the budget starts with the header, reading the body spends it too
+        unsigned int timeout = state_->handler_timeout(req.target());
+        if(timeout > 0){
+            handler_deadline_ = header_received_ + std::chrono::milliseconds(timeout);
+            request->deadline_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                handler_deadline_.time_since_epoch()).count();
+        }
+
+
+        std::shared_ptr<concurrency_limit> limit = state_->limit_for(req.target());
+
+        if(limit == NULL && !http_handler_->use_async() && !state_->opts()->fibers && !state_->workers()){
+            // blocks the io thread, nothing can answer for it, the deadline
+            // only tells the handler its budget
+            timing_.handler_start = std::chrono::steady_clock::now();
+            response_t* resp = http_handler_->dispatch(request);
+            timing_.handler_done = std::chrono::steady_clock::now();
+            timing_.handled = true;
+            return send_response_t(resp);
+        }
+
+        handler_deadline(timeout);
+        auto answer = answer_callback();
+
+        if(limit == NULL)
+            return start_handler(request, std::move(answer));
+
+        // the route's bulkhead starts the handler once it has a slot, the
+        // deadline and a disconnect may end the wait first
+        call_->limit = limit;
+        // (posted, the releasing thread would otherwise run an inline
+        // handler before sending its own response)
+        bool admitted = limit->acquire([self = shared_from_this(), call = call_, request, answer]() {
+            net::post(
+                self->socket_.get_executor(),
+                [self, call, request, answer]() mutable {
+                    if(call->timed_out || request_cancelled(request))
+                        return answer(NULL);
+                    self->start_handler(request, std::move(answer));
+                });
+        });
+
+        if(!admitted){
+            call_.reset();
+            hold_.reset();
+            state_->rejected(http::status::service_unavailable);
+            return send_response(busy_response("Server busy"));
+        }
+    }
+
+    // Calls the handler in the configured mode, answer takes its response
+    void start_handler(request_t* request, std::function<void(response_t*)>&& answer){
+
+        if(http_handler_->use_async()) {
+            // the handler may answer from any thread
+            call_->started = std::chrono::steady_clock::now();
+            http_handler_->dispatch_async(request, std::move(answer));
+        } else if(state_->opts()->fibers) {
+            // runs once the io loop yields, a handler that waits in a
+            // fiber_ call gives the thread back until it is woken
+            fiber::spawn([self = shared_from_this(), call = call_, request, answer = std::move(answer),
+                          queued_at = std::chrono::steady_clock::now()](){
+                // the client left while the fiber waited to run
+                if(request_cancelled(request) || !self->started(queued_at))
+                    return answer(NULL);
+                call->started = std::chrono::steady_clock::now();
+                answer(self->http_handler_->dispatch(request));
+            });
+        } else if(worker_pool* workers = state_->workers()) {
+            // the io thread goes back to other connections, the worker
+            // hands the response back to the session's executor
+            bool queued = workers->post([self = shared_from_this(), call = call_, request, answer,
+                                         queued_at = std::chrono::steady_clock::now()](){
+                if(request_cancelled(request) || !self->started(queued_at))
+                    return answer(NULL);
+                call->started = std::chrono::steady_clock::now();
+                answer(self->http_handler_->dispatch(request));
+            }, priority_);
+
+            if(!queued){
+                state_->rejected(http::status::service_unavailable);
+                answer(NULL);
+            }
+        } else {
+            // a route limit keeps this request waiting, the handler runs
+            // inline once it has a slot
+            call_->started = std::chrono::steady_clock::now();
+            answer(http_handler_->dispatch(request));
+        }
+    }
+
+    // Answers opts->liveness_path, opts->readiness_path, opts->metrics_path,
+    // opts->histograms_path and opts->slow_requests_path on the io thread, they never wait for a
+    // handler, a worker or admission
+    bool native_endpoint(beast::string_view target){
+
+        server_opts* opts = state_->opts();
+
+        if(opts->liveness_path != NULL && target == opts->liveness_path){
+            send_response(error_response(http::status::ok, "OK"));
+            return true;
+        }
+
+        if(opts->metrics_path != NULL && target == opts->metrics_path){
+            auto res = error_response(http::status::ok, state_->metrics_text());
+            res.set(http::field::content_type, "text/plain; version=0.0.4");
+            send_response(std::move(res));
+            return true;
+        }
 
-        if(verb.empty()){
-            return send_response(bad_request("Unknown HTTP-method"));
+        if(opts->histograms_path != NULL && target == opts->histograms_path){
+            send_response(error_response(http::status::ok, state_->histograms_text()));
+            return true;
         }
 
-        std::string target = std::string { req.target().data(), req.target().size() };
-        std::string body_str = std::string { req.body().data(), req.body().size() };
-        int body_size = body_str.size();
+        if(opts->slow_requests_path != NULL && target == opts->slow_requests_path){
+            send_response(error_response(http::status::ok, state_->slow_requests_text()));
+            return true;
+        }
 
-        //auto body_data = req.body().data();
-        //const auto buffer_bytes = buffer_.cdata();
+        if(opts->readiness_path != NULL && target == opts->readiness_path){
+            if(state_->draining())
+                send_response(error_response(http::status::service_unavailable, "Draining"));
+            else
+                send_response(error_response(http::status::ok, "OK"));
+            return true;
+        }
 
+        return false;
+    }
 
-        //const char* body_raw = static_cast<const char*>(buffer_bytes.data());
+    // Reports how long a pooled or fiber handler waited to start, false
+    // when admission control sheds it instead. Runs on the handler's thread.
+    bool started(std::chrono::steady_clock::time_point queued){
+        admission_control* admission = state_->admission();
+        if(admission == NULL || admission->started(std::chrono::steady_clock::now() - queued, priority_))
+            return true;
+        state_->shed();
+        return false;
+    }
 
-        request_t* request = request_new(verb.c_str(), target.c_str());
+    // One call into the handler, answered once: by the handler or, past
+    // its deadline, by a 504. Whichever comes second only cleans up.
+    struct handler_call {
+        request_t* request = NULL;
+        // set by the 504, the call owns the request and its storage then
+        bool timed_out = false;
+        std::unique_ptr<request_storage> storage;
+        // the route's bulkhead slot, released with the answer
+        std::shared_ptr<concurrency_limit> limit;
+        // set by the thread running the handler, read once it answered
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point answered;
+    };
+
+    void handler_deadline(unsigned int timeout){
+        if(timeout > 0)
+            deadline(handler_deadline_);
+        else
+            cancel_deadline();
+    }
 
-        std::vector<std::pair<std::string, std::string>> hs;
-        for (auto const& kv: req.base()){
+    // The session stays alive until the handler answers or times out, the
+    // answer comes back on the session's executor. A NULL answer closes
+    // the connection of a cancelled request and answers others with 503.
+    std::function<void(response_t*)> answer_callback(){
+
+        auto call = std::make_shared<handler_call>();
+        call->request = request_;
+        call_ = call;
+        hold_ = shared_from_this();
+
+        watch_disconnect();
+
+        return [weak = weak_from_this(), call](response_t* resp){
+            call->answered = std::chrono::steady_clock::now();
+            release_limit(*call);
+
+            auto self = weak.lock();
+            if(!self)
+                return drop_answer(*call, resp);
+
+            net::dispatch(
+                self->socket_.get_executor(),
+                [self, call, resp]() {
+                    if(call->timed_out)
+                        return drop_answer(*call, resp);
+                    self->stop_watching();
+                    self->call_.reset();
+                    self->hold_.reset();
+                    if(resp == NULL && request_cancelled(call->request))
+                        return self->abort();
+                    if(resp == NULL)
+                        return self->send_response(self->busy_response("Server overloaded"));
+                    self->timing_.handler_start = call->started;
+                    self->timing_.handler_done = call->answered;
+                    self->timing_.handled = true;
+                    self->send_response_t(resp);
+                });
+        };
+    }
 
-            auto name = std::string{ kv.name_string().data(), kv.name_string().size() };
-            auto value = std::string{ kv.value().data(), kv.value().size() };
+    // A client waiting for its answer sends nothing, the socket turning
+    // readable is EOF or a reset and cancels the request. Pipelined data
+    // means the client is still there and ends the watch, it is left on
+    // the socket for the next read.
+    void watch_disconnect(){
+        watching_ = true;
+        socket_.async_wait(
+            stream_protocol::socket::wait_read,
+            [self = shared_from_this(), watched = std::weak_ptr<handler_call>(call_)](
+                beast::error_code ec) {
+                // stop_watching, possibly ahead of a newer watch
+                if(ec == net::error::operation_aborted)
+                    return;
+                self->watching_ = false;
+                auto call = watched.lock();
+                // answered or timed out meanwhile
+                if(!call || call != self->call_)
+                    return;
+
+                if(!ec){
+                    char c;
+                    ssize_t n = ::recv(self->socket_.native_handle(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+                    if(n > 0)
+                        return;
+                    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                        return self->watch_disconnect();
+                }
+
+                self->state_->cancelled();
+                cancel_request(call->request);
+            });
+    }
 
-            if(name == "Content-Type" || name == "content-type") {
-                request->content_type = value.c_str();
-            }
+    // The wait holds the session, it must not outlive the call: after a
+    // Connection: close answer nothing else would end it but the peer
+    void stop_watching(){
+        if(!watching_)
+            return;
+        watching_ = false;
+        beast::error_code ec;
+        socket_.cancel(ec);
+    }
 
-            hs.push_back({name, value});
-        }
+    void handler_timed_out(){
 
-        int hsize = hs.size();
-        if(hsize > 0){
-            request->headers = headers_new(hsize);
-            header_t* headers = (header_t*) malloc(sizeof(header_t)*hsize);
+        stop_watching();
 
-            for(int i = 0; i < hsize; i++){
-                headers[i].name = hs[i].first.c_str();
-                headers[i].value = hs[i].second.c_str();
-            }
+        // the late answer frees the request, the next one gets new storage
+        call_->timed_out = true;
+        call_->storage = std::move(request_storage_);
+        request_ = NULL;
+        call_.reset();
 
-            request->headers->headers = headers;
-        }
+        auto self = std::move(hold_);
 
-        if(body_size > 0){
-            body_t* body = body_new(body_str.c_str(), NULL, body_size);
-            request->body = body;
-        }
+        state_->rejected(http::status::gateway_timeout);
+        send_response(error_response(http::status::gateway_timeout, "Handler timed out"));
+    }
 
+    // The handler is done, a late answer frees its slot as well
+    static void release_limit(handler_call& call){
 
-        if(http_handler_->use_async()) {
-            return http_handler_->dispatch_async(request, [this](response_t* resp){
-                send_response_t(resp);
-            });
-        } else {
-            response_t* resp = http_handler_->dispatch(request);
-            return send_response_t(resp);
+        if(call.limit == NULL)
+            return;
+
+        auto limit = std::move(call.limit);
+        if(call.started != std::chrono::steady_clock::time_point())
+            limit->release(std::chrono::steady_clock::now() - call.started);
+        else
+            limit->release();
+    }
+
+    static void drop_answer(handler_call& call, response_t* resp){
+
+        if(resp != NULL && resp->body != NULL){
+            if(resp->body->release != NULL)
+                resp->body->release(resp->body->body_raw, resp->body->size);
+            if(resp->body->fd >= 0)
+                ::close(resp->body->fd);
+        }
+
+        // after a 504 the session let go of the request
+        if(call.timed_out && call.request != NULL){
+            request_free(call.request);
+            call.request = NULL;
         }
     }
 
@@ -362,11 +1846,57 @@ private:
 
 
 private:
-    beast::tcp_stream stream_;
+    stream_protocol::socket socket_;
     //boost::asio::deadline_timer deadline_timer_;
     std::unique_ptr<http_handler> http_handler_;
     http::request<http::string_body> req_;
+    boost::optional<http::request_parser<http::string_body>> parser_;
     beast::flat_buffer buffer_;
+    std::shared_ptr<server_state> state_;
+    std::shared_ptr<http_server> server_;
+    request_t* request_ = NULL;
+    std::unique_ptr<request_storage> request_storage_;
+    std::shared_ptr<handler_call> call_;
+    std::shared_ptr<http_session> hold_;
+    std::chrono::steady_clock::time_point header_received_;
+    // when each phase of the current request ended
+    struct request_timing {
+        std::chrono::steady_clock::time_point read_start;
+        std::chrono::steady_clock::time_point header;
+        std::chrono::steady_clock::time_point read_done;
+        std::chrono::steady_clock::time_point converted;
+        std::chrono::steady_clock::time_point handler_start;
+        std::chrono::steady_clock::time_point handler_done;
+        std::chrono::steady_clock::time_point write_start;
+        std::size_t route = 0;
+        bool handled = false;
+    } timing_;
+    int priority_ = PRIORITY_NORMAL;
+    // the access log record of the current request, filled in as it goes
+    access_record access_ = {};
+    std::chrono::steady_clock::time_point handler_deadline_;
+    const std::chrono::steady_clock::time_point connected_ = std::chrono::steady_clock::now();
+    address_t client_address_ = {};
+    address_t local_address_ = {};
+    address_t peer_address_ = {};
+    // of an AF_UNIX peer, its rate limit key
+    ucred peer_credentials_ = {};
+    timer_wheel& timers_;
+    std::uint64_t timer_generation_ = 0;
+    std::chrono::steady_clock::time_point body_started_;
+    std::size_t body_read_ = 0;
+    std::size_t requests_ = 0;
+    bool idle_ = false;
+    bool watching_ = false;
+    bool keep_alive_ = false;
+    body_t* write_body_ = NULL;
+    bool zerocopy_enabled_ = false;
+    bool zerocopy_failed_ = false;
+    bool zerocopy_waiting_ = false;
+    bool closing_ = false;
+    std::uint32_t zerocopy_sent_ = 0;
+    std::uint32_t zerocopy_completed_ = 0;
+    zerocopy_pending zerocopy_pending_;
 };
 
 class http_server : public std::enable_shared_from_this<http_server>  {
@@ -374,15 +1904,32 @@ class http_server : public std::enable_shared_from_this<http_server>  {
 public:
 
     http_server(net::io_context& io,
-                std::shared_ptr<beast_handler_t> handler,
-                tcp::endpoint endpoint)
+                std::shared_ptr<server_state> state,
+                stream_protocol::endpoint endpoint)
         :io_(io),
         acceptor_(net::make_strand(io)),
-        http_handler_(handler)
+        state_(state)
     {
 
         beast::error_code ec;
 
+        // Take over the socket of the process we replace, its backlog
+        // is kept and no connection is refused in between
+        int fd = state_->take_listener(endpoint);
+        if(fd >= 0)
+        {
+            acceptor_.assign(endpoint.protocol(), fd, ec);
+            if(ec)
+                fail(ec, "assign");
+            return;
+        }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+        // a stale socket file from a previous run makes bind fail
+        if(endpoint.protocol().family() == AF_UNIX)
+            ::unlink(reinterpret_cast<const sockaddr_un*>(endpoint.data())->sun_path);
+#endif
+
         // Open the acceptor
         acceptor_.open(endpoint.protocol(), ec);
         if(ec)
@@ -421,6 +1968,13 @@ public:
 
     void run(){
         //std::cout << "http_server::run" << std::endl;
+
+        // open, bind or listen failed and was reported already
+        if(!acceptor_.is_open())
+            return;
+
+        state_->add_server(this->shared_from_this());
+
         net::dispatch(
             acceptor_.get_executor(),
             beast::bind_front_handler(
@@ -428,6 +1982,46 @@ public:
                 this->shared_from_this()));
     }
 
+    // Closes the listening socket, the pending accept completes with
+    // operation_aborted and is not re-armed
+    void stop(){
+        net::dispatch(
+            acceptor_.get_executor(),
+            [self = this->shared_from_this()]() {
+                beast::error_code ec;
+                self->acceptor_.close(ec);
+            });
+    }
+
+    int native_handle(){
+        return acceptor_.native_handle();
+    }
+
+    // Called from ~http_session, on any thread
+    void session_closed(){
+        connections_--;
+    }
+
+    // Re-arms a paused accept once this listener and the server are
+    // below their connection limits again
+    void resume(){
+        if(!paused_)
+            return;
+
+        net::dispatch(
+            acceptor_.get_executor(),
+            [self = this->shared_from_this()]() {
+                if(!self->paused_ || self->at_capacity())
+                    return;
+
+                self->paused_ = false;
+                self->state_->accept_resumed(std::chrono::steady_clock::now() - self->paused_at_);
+
+                if(self->acceptor_.is_open() && !self->state_->draining())
+                    self->do_accept();
+            });
+    }
+
 
 private:
 
@@ -447,33 +2041,484 @@ private:
                 shared_from_this()));
     }
 
-    void on_accept(const boost::system::error_code& ec, tcp::socket socket){
+    void on_accept(const boost::system::error_code& ec, stream_protocol::socket socket){
 
         //std::cout << "http_server::on_accept" << std::endl;
+        if(!acceptor_.is_open() || state_->draining())
+            return;
+
+        if(ec)
+            thread_metrics::add(metrics::local().accept_errors);
+
         if(!ec){
 
-            std::unique_ptr<http_handler> handler(new http_handler(http_handler_->sync, http_handler_->async));
+            beast_handler_t* callbacks = state_->handler();
+            std::unique_ptr<http_handler> handler(new http_handler(callbacks->sync, callbacks->async));
+
+            connections_++;
 
             // Create the http session and run it
             std::make_shared<http_session>(
                 std::move(socket),
-                std::move(handler))->run();
+                std::move(handler),
+                state_,
+                shared_from_this())->run();
+
+        }
+
+        if(at_capacity()){
+            paused_ = true;
+            paused_at_ = std::chrono::steady_clock::now();
+            state_->accept_paused();
 
+            // a session may have closed before paused_ was visible
+            return resume();
         }
+
         do_accept();
     }
 
+    bool at_capacity(){
+        unsigned int max = state_->opts()->max_listener_connections;
+        return (max > 0 && connections_ >= max) || state_->at_capacity();
+    }
+
 
     net::io_context& io_;
-    tcp::acceptor acceptor_;
-    std::shared_ptr<beast_handler_t> http_handler_;
+    stream_acceptor acceptor_;
+    std::shared_ptr<server_state> state_;
+    std::atomic<unsigned int> connections_{0};
+    std::atomic<bool> paused_{false};
+    std::chrono::steady_clock::time_point paused_at_;
+};
+
+http_session::~http_session(){
+    timers_.cancel(this);
+
+    // closing the socket would not unpin these pages, the reaper keeps it
+    // until the kernel reports them done
+    if(!zerocopy_pending_.empty())
+        zerocopy_reaper::start(std::move(socket_), zerocopy_completed_, std::move(zerocopy_pending_));
+
+    if(request_ != NULL)
+        request_free(request_);
+
+    thread_metrics::add(metrics::local().connections_closed);
+    server_->session_closed();
+    state_->remove_session(this);
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+// Hands the listening sockets to a newer process connecting on
+// opts->handoff_path, then drains this one
+class handoff_listener : public std::enable_shared_from_this<handoff_listener> {
+
+public:
+
+    handoff_listener(net::io_context& io,
+                     std::shared_ptr<server_state> state,
+                     const char* path)
+        :acceptor_(net::make_strand(io)),
+        state_(state)
+    {
+        beast::error_code ec;
+        net::local::stream_protocol::endpoint endpoint(path);
+
+        // the previous process still listens here, its handoff is done
+        ::unlink(path);
+
+        acceptor_.open(endpoint.protocol(), ec);
+        if(ec)
+        {
+            fail(ec, "handoff open");
+            return;
+        }
+
+        acceptor_.bind(endpoint, ec);
+        if(ec)
+        {
+            fail(ec, "handoff bind");
+            return;
+        }
+
+        acceptor_.listen(1, ec);
+        if(ec)
+        {
+            fail(ec, "handoff listen");
+            return;
+        }
+    }
+
+    void run(){
+
+        if(!acceptor_.is_open())
+            return;
+
+        state_->set_handoff(this->shared_from_this());
+
+        net::dispatch(
+            acceptor_.get_executor(),
+            beast::bind_front_handler(
+                &handoff_listener::do_accept,
+                this->shared_from_this()));
+    }
+
+    void stop(){
+        net::dispatch(
+            acceptor_.get_executor(),
+            [self = this->shared_from_this()]() {
+                beast::error_code ec;
+                self->acceptor_.close(ec);
+            });
+    }
+
+private:
+
+    void
+    fail(beast::error_code ec, char const* what)
+    {
+        std::cerr << what << ": " << ec.message() << "\n";
+    }
+
+    void do_accept(){
+        acceptor_.async_accept(
+            beast::bind_front_handler(
+                &handoff_listener::on_accept,
+                shared_from_this()));
+    }
+
+    void on_accept(const boost::system::error_code& ec,
+                   net::local::stream_protocol::socket socket){
+
+        if(!acceptor_.is_open() || state_->draining())
+            return;
+
+        if(ec)
+            return do_accept();
+
+        std::vector<int> fds = state_->listener_fds();
+
+        if(!handoff::send(socket.native_handle(), fds)){
+            std::cerr << "handoff: sending " << fds.size() << " listeners failed" << std::endl;
+            return do_accept();
+        }
+
+        std::cout << "Server handed " << fds.size() << " listeners over" << std::endl;
+
+        // the new process owns the backlog now, finish what we have
+        state_->drain();
+    }
+
+    net::local::stream_protocol::acceptor acceptor_;
+    std::shared_ptr<server_state> state_;
 };
 
+#endif
+
+void server_state::add_server(std::shared_ptr<http_server> server){
+    std::lock_guard<std::mutex> lock(mutex_);
+    servers_.push_back(server);
+}
+
+void server_state::add_listeners(const std::vector<int>& fds){
+    std::lock_guard<std::mutex> lock(mutex_);
+    listeners_.insert(listeners_.end(), fds.begin(), fds.end());
+}
+
+int server_state::take_listener(const stream_protocol::endpoint& endpoint){
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto it = listeners_.begin(); it != listeners_.end(); ++it){
+        if(handoff::bound_to(*it, endpoint.data())){
+            int fd = *it;
+            listeners_.erase(it);
+            return fd;
+        }
+    }
+    return -1;
+}
+
+void server_state::close_unused_listeners(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(int fd : listeners_)
+        ::close(fd);
+    listeners_.clear();
+}
+
+std::vector<int> server_state::listener_fds(){
+    std::vector<int> fds;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto& server : servers_)
+        if(auto s = server.lock())
+            fds.push_back(s->native_handle());
+    return fds;
+}
+
+void server_state::start_timer_wheels(std::size_t count){
+    // 100ms resolution, 512 slots is one revolution per 51.2s
+    for(std::size_t i = 0; i < count; i++){
+        timer_wheels_.emplace_back(
+            new timer_wheel(io_, std::chrono::milliseconds(100), 512));
+        timer_wheels_.back()->start();
+    }
+}
+
+void server_state::start_workers(){
+    if(opts_->worker_threads > 0)
+        workers_.reset(new worker_pool(opts_->worker_threads, opts_->worker_queue_size));
+
+    // inline and async handlers start right away, only pooled and fiber
+    // handlers queue
+    bool queued = opts_->worker_threads > 0 || opts_->fibers;
+    if(queued && opts_->admission_target_ms > 0)
+        admission_.reset(new admission_control(
+            opts_->admission_target_ms,
+            opts_->admission_interval_ms > 0 ? opts_->admission_interval_ms : 100));
+}
+
+void server_state::stop_workers(){
+    if(workers_)
+        workers_->stop();
+}
+
+void server_state::set_handoff(std::shared_ptr<handoff_listener> handoff){
+    std::lock_guard<std::mutex> lock(mutex_);
+    handoff_ = handoff;
+}
+
+void server_state::add_session(std::shared_ptr<http_session> session){
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_[session.get()] = session;
+    connections_++;
+}
+
+void server_state::remove_session(http_session* session){
+    bool drained;
+    std::vector<std::shared_ptr<http_server>> paused;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions_.erase(session);
+        connections_--;
+        drained = draining_ && sessions_.empty();
+
+        if(paused_listeners_ > 0)
+            for(auto& server : servers_)
+                if(auto s = server.lock())
+                    paused.push_back(s);
+    }
+
+    for(auto& server : paused)
+        server->resume();
+
+    if(drained)
+        stop();
+}
+
+void server_state::accept_paused(){
+    paused_listeners_++;
+    accept_pauses_++;
+}
+
+void server_state::accept_resumed(std::chrono::steady_clock::duration paused){
+    paused_listeners_--;
+    accept_paused_us_ += std::chrono::duration_cast<std::chrono::microseconds>(paused).count();
+}
+
+void server_state::drain(){
+
+    if(draining_.exchange(true))
+        return;
+
+    std::vector<std::shared_ptr<http_server>> servers;
+    std::vector<std::shared_ptr<http_session>> sessions;
+    std::shared_ptr<handoff_listener> handoff;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        handoff = handoff_.lock();
+        for(auto& server : servers_)
+            if(auto s = server.lock())
+                servers.push_back(s);
+        for(auto& session : sessions_)
+            if(auto s = session.second.lock())
+                sessions.push_back(s);
+    }
+
+    std::cout << "Server draining " << sessions.size() << " connections.." << std::endl;
+
+    for(auto& server : servers)
+        server->stop();
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    if(handoff)
+        handoff->stop();
+#endif
+
+    for(auto& session : sessions)
+        session->close_if_idle();
+
+    if(sessions.empty())
+        return stop();
+
+    drain_timer_.expires_after(std::chrono::milliseconds(opts_->drain_timeout_ms));
+    drain_timer_.async_wait(
+        [this](beast::error_code ec) {
+            if(ec)
+                return;
+            std::cout << "Server drain timeout" << std::endl;
+            stop();
+        });
+}
+
+static void metric(std::ostringstream& out, const char* name, const char* type,
+                   const char* help, std::uint64_t value){
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " " << type << "\n"
+        << name << " " << value << "\n";
+}
+
+std::string server_state::metrics_text(){
+
+    metrics_snapshot m = metrics::sum();
+    std::ostringstream out;
+
+    metric(out, "httpserver_requests_total", "counter", "Requests read", m.requests);
+
+    out << "# HELP httpserver_responses_total Responses sent by status class\n"
+        << "# TYPE httpserver_responses_total counter\n";
+    for(int i = 0; i < 5; i++)
+        out << "httpserver_responses_total{code=\"" << i + 1 << "xx\"} " << m.responses[i] << "\n";
+
+    metric(out, "httpserver_received_bytes_total", "counter", "Request bytes read", m.bytes_in);
+    metric(out, "httpserver_sent_bytes_total", "counter", "Response bytes written", m.bytes_out);
+    metric(out, "httpserver_connections", "gauge", "Open connections",
+           m.connections_opened - m.connections_closed);
+    metric(out, "httpserver_connections_total", "counter", "Connections accepted", m.connections_opened);
+    metric(out, "httpserver_accept_errors_total", "counter", "Failed accepts", m.accept_errors);
+    metric(out, "httpserver_timeouts_total", "counter",
+           "Connections closed by a header, body, write or keep-alive timeout", m.timeouts);
+    metric(out, "httpserver_handler_timeouts_total", "counter",
+           "Requests answered 504 past the handler deadline", handler_timeouts_);
+    metric(out, "httpserver_cancelled_total", "counter",
+           "Requests whose client disconnected before the handler answered", cancelled_);
+    metric(out, "httpserver_accept_pauses_total", "counter",
+           "Times a listener stopped accepting at the connection limit", accept_pauses_);
+    out << "# HELP httpserver_accept_paused_seconds_total Time listeners spent paused\n"
+        << "# TYPE httpserver_accept_paused_seconds_total counter\n"
+        << "httpserver_accept_paused_seconds_total " << accept_paused_us_ / 1000000 << "."
+        << std::setfill('0') << std::setw(6) << accept_paused_us_ % 1000000 << std::setfill(' ') << "\n";
+
+    out << "# HELP httpserver_rejected_total Requests refused before or instead of the handler\n"
+        << "# TYPE httpserver_rejected_total counter\n"
+        << "httpserver_rejected_total{reason=\"header_too_large\"} " << rejected_headers_ << "\n"
+        << "httpserver_rejected_total{reason=\"body_too_large\"} " << rejected_bodies_ << "\n"
+        << "httpserver_rejected_total{reason=\"precheck\"} " << rejected_prechecks_ << "\n"
+        << "httpserver_rejected_total{reason=\"queue_full\"} " << rejected_busy_ << "\n"
+        << "httpserver_rejected_total{reason=\"rate_limited\"} " << rate_limited_ << "\n"
+        << "httpserver_rejected_total{reason=\"shed\"} " << shed_ << "\n";
+
+    if(!limits_.empty()){
+        out << "# HELP httpserver_route_concurrency_limit Current adaptive limit of a route\n"
+            << "# TYPE httpserver_route_concurrency_limit gauge\n";
+        for(auto& limit : limits_)
+            out << "httpserver_route_concurrency_limit{route=\"" << limit.first->prefix << "\"} "
+                << limit.second->limit() << "\n";
+    }
+
+    return out.str();
+}
+
+// Reached from the drain deadline and from the last session closing,
+// whichever comes first stops the server
+void server_state::stop(){
+    if(stopped_.exchange(true))
+        return;
+
+    if(accept_pauses_ > 0)
+        std::cout << "accept paused " << accept_pauses_ << " times for "
+                  << accept_paused_us_ / 1000 << "ms at the connection limit" << std::endl;
+
+    if(rejected_headers_ > 0 || rejected_bodies_ > 0)
+        std::cout << "rejected " << rejected_headers_ << " oversized headers (431), "
+                  << rejected_bodies_ << " oversized bodies (413)" << std::endl;
+
+    if(rejected_prechecks_ > 0)
+        std::cout << "refused " << rejected_prechecks_ << " requests before 100-continue" << std::endl;
+
+    if(rejected_busy_ > 0)
+        std::cout << "answered " << rejected_busy_ << " requests with 503, worker or route queue full" << std::endl;
+
+    if(rate_limited_ > 0)
+        std::cout << "answered " << rate_limited_ << " requests with 429, rate limit" << std::endl;
+
+    if(shed_ > 0)
+        std::cout << "shed " << shed_ << " requests with 503, queue delay over "
+                  << opts_->admission_target_ms << "ms" << std::endl;
+
+    if(handler_timeouts_ > 0)
+        std::cout << "answered " << handler_timeouts_ << " requests with 504, handler timed out" << std::endl;
+
+    if(cancelled_ > 0)
+        std::cout << "cancelled " << cancelled_ << " requests, client disconnected" << std::endl;
+
+    if(slow_requests_ && slow_requests_->captured() > 0)
+        std::cout << "captured " << slow_requests_->captured() << " requests slower than "
+                  << opts_->slow_request_ms << "ms" << std::endl;
+
+    std::cout << "Server stopping.." << std::endl;
+
+    for(auto& wheel : timer_wheels_)
+        wheel->stop();
+    io_.stop();
+
+    if(access_log_)
+        access_log_->stop();
+}
+
+
+// Name of the reactor/proactor asio was built with, see HTTPSERVER_IO_URING
+static const char* io_backend(){
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+    return "io_uring";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+    return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+    return "kqueue";
+#else
+    return "select";
+#endif
+}
+
+// Resolves one configured listener, TCP (IPv4 or IPv6) or AF_UNIX
+static stream_protocol::endpoint make_endpoint(const endpoint_t& ep){
+
+    if(ep.unix_path != NULL){
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+        return net::local::stream_protocol::endpoint(ep.unix_path);
+#else
+        throw std::runtime_error("unix domain sockets are not supported");
+#endif
+    }
+
+    return tcp::endpoint{net::ip::make_address(ep.address), ep.port};
+}
+
+static std::string endpoint_name(const endpoint_t& ep){
+
+    if(ep.unix_path != NULL)
+        return std::string("unix:") + ep.unix_path;
+
+    std::string address { ep.address };
+    if(address.find(':') != std::string::npos)
+        address = "[" + address + "]";
+
+    return "http://" + address + ":" + std::to_string(ep.port);
+}
 
 // anticrisis: change main to run; remove doc_root
 int run(char* address_,
         unsigned short   port,
         unsigned short   max_thread_count,
+        server_opts*     opts,
         beast_handler_t* handler){
 
 
@@ -481,41 +2526,113 @@ int run(char* address_,
     {
         //thread_count = 0;
 
-        auto const address = net::ip::make_address(address_);        
+        // address_ and port are the first listener, opts->endpoints adds more
+        std::vector<endpoint_t> endpoints;
+
+        if(address_ != NULL && *address_ != '\0')
+            endpoints.push_back({address_, port, NULL});
+
+        if(opts->endpoints != NULL)
+            for(int i = 0; i < opts->endpoints->size; i++)
+                endpoints.push_back(opts->endpoints->endpoints[i]);
+
+        if(endpoints.empty())
+            throw std::invalid_argument("no address to listen on");
 
         // The io_context is required for all I/O
         net::io_context io{max_thread_count};
 
+        std::shared_ptr<beast_handler_t> handler_ptr(handler);
+        std::shared_ptr<server_opts> opts_ptr(opts, free);
+        auto state = std::make_shared<server_state>(io, handler_ptr, opts_ptr);
+        state->start_timer_wheels(max_thread_count > 0 ? max_thread_count : 1);
+        state->start_workers();
+
         net::signal_set signals(io, SIGINT, SIGTERM);
-        signals.async_wait(
-            [&](beast::error_code const&, int)
+        std::function<void(beast::error_code const&, int)> on_signal =
+            [&](beast::error_code const& ec, int)
             {
+                if(ec)
+                    return;
+
                 // Stop the `io_context`. This will cause `run()`
                 // to return immediately, eventually destroying the
                 // `io_context` and all of the sockets in it.
-                std::cout << "Server stopping.." << std::endl;
-                io.stop();
-            });
+                // A second signal while draining stops right away.
+                if(opts->drain_timeout_ms == 0 || state->draining())
+                    return state->stop();
+
+                state->drain();
+                signals.async_wait(on_signal);
+            };
+        signals.async_wait(on_signal);
+
+        // listeners of the process we replace, by socket activation or
+        // received from its handoff socket
+        std::vector<int> listeners = handoff::inherited();
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+        if(opts->handoff_path != NULL){
+            std::vector<int> received = handoff::receive(opts->handoff_path);
+            listeners.insert(listeners.end(), received.begin(), received.end());
+        }
+#endif
 
-        std::shared_ptr<beast_handler_t> handler_ptr(handler);
-        std::make_shared<http_server>(
-            io, handler_ptr, tcp::endpoint{address, port})->run();
+        if(!listeners.empty())
+            std::cout << "taking over " << listeners.size() << " listeners" << std::endl;
+
+        state->add_listeners(listeners);
+
+        // every listener shares the handler and options
+        for(auto& ep : endpoints){
+            std::make_shared<http_server>(
+                io, state, make_endpoint(ep))->run();
 
-        std::cout << "http server at http://" << address_ << ":" << port << " with " << max_thread_count << " threads" << std::endl;
+            std::cout << "http server at " << endpoint_name(ep) << " with " << max_thread_count << " threads"
+                      << " (" << io_backend() << ")" << std::endl;
+        }
+
+        state->close_unused_listeners();
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+        if(opts->handoff_path != NULL)
+            std::make_shared<handoff_listener>(
+                io, state, opts->handoff_path)->run();
+#endif
 
         std::vector<std::thread> thread_pool;
-        thread_pool.reserve(max_thread_count - 1);
-        for(auto i = max_thread_count - 1; i > 0; --i)
-            thread_pool.emplace_back(
-                [&io]
-                {
-                    io.run();
-                });
 
-        io.run();
+        if(opts->fibers){
+            fiber::stack_pool::configure(opts->fiber_stack_size, opts->fiber_huge_pages != 0);
+
+            // every io thread runs handler fibers and steals ready ones
+            // from busy threads; a thread's fiber scheduler refers to io
+            // and has to go with its thread before io is destroyed
+            unsigned short fiber_threads = max_thread_count > 0 ? max_thread_count : 1;
+            thread_pool.reserve(fiber_threads);
+            for(auto i = fiber_threads; i > 0; --i)
+                thread_pool.emplace_back(
+                    [&io, fiber_threads]
+                    {
+                        fiber::run(io, fiber_threads);
+                    });
+        } else {
+            thread_pool.reserve(max_thread_count - 1);
+            for(auto i = max_thread_count - 1; i > 0; --i)
+                thread_pool.emplace_back(
+                    [&io]
+                    {
+                        io.run();
+                    });
+
+            io.run();
+        }
+
         for (auto& th : thread_pool)
             th.join();
 
+        state->stop_workers();
+
     }
     catch (const std::exception& e)
     {
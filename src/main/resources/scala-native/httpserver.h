@@ -1,18 +1,35 @@
 #ifndef HTTPSERVER_H
 #define HTTPSERVER_H
 
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/config.hpp>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <boost/asio.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 #include <boost/bind.hpp>
+#include <boost/optional.hpp>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
 #include <string>
 #include <boost/thread.hpp>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include "http_handler.h"
 
@@ -22,12 +39,19 @@ namespace beast = boost::beast;         // from <boost/beast.hpp>
 namespace http  = beast::http;          // from <boost/beast/http.hpp>
 namespace net   = boost::asio;          // from <boost/asio.hpp>
 using tcp       = boost::asio::ip::tcp; // from <boost/asio/ip/tcp.hpp>
+// TCP and AF_UNIX listeners share one session type
+using stream_protocol = boost::asio::generic::stream_protocol;
+using stream_acceptor = boost::asio::basic_socket_acceptor<stream_protocol>;
 
 int run(char*            address_,
         unsigned short   port,        
         unsigned short   max_thread_count,
+        server_opts*     opts,
         beast_handler_t*   handler);
 
+// Marks req cancelled and runs its on_cancel_ callback, once
+void cancel_request(request_t* req);
+
 }
 
 #endif // HTTPSERVER_H
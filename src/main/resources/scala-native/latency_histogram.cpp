@@ -0,0 +1,227 @@
+
+#include <algorithm>
+#include <cstdio>
+
+#include <boost/beast/zlib/deflate_stream.hpp>
+
+#include "latency_histogram.h"
+
+namespace httpserver {
+
+static const char* phase_names[] = {
+    "header", "body", "convert", "queue", "handler", "serialize", "write", "total"
+};
+
+static void
+put32(std::string& out, std::uint32_t v){
+    for(int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<char>(v >> shift));
+}
+
+static void
+put64(std::string& out, std::uint64_t v){
+    put32(out, static_cast<std::uint32_t>(v >> 32));
+    put32(out, static_cast<std::uint32_t>(v));
+}
+
+// ZigZag LEB128 as HdrHistogram writes it, the ninth byte holds 8 bits
+static void
+put_varint(std::string& out, std::int64_t signed_value){
+    std::uint64_t v = (static_cast<std::uint64_t>(signed_value) << 1) ^ static_cast<std::uint64_t>(signed_value >> 63);
+    for(int i = 0; i < 8; i++){
+        if(v < 0x80){
+            out.push_back(static_cast<char>(v));
+            return;
+        }
+        out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+static std::string
+zlib_compress(const std::string& in){
+
+    boost::beast::zlib::deflate_stream stream;
+    std::string raw(stream.upper_bound(in.size()), '\0');
+
+    boost::beast::zlib::z_params zs;
+    zs.next_in = in.data();
+    zs.avail_in = in.size();
+    zs.next_out = &raw[0];
+    zs.avail_out = raw.size();
+
+    boost::beast::error_code ec;
+    stream.write(zs, boost::beast::zlib::Flush::finish, ec);
+    raw.resize(zs.total_out);
+
+    // the stream is raw deflate, the decoders expect the zlib wrapper
+    std::uint32_t a = 1, b = 0;
+    for(unsigned char c : in){
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+
+    std::string out = "\x78\x9c";
+    out += raw;
+    put32(out, (b << 16) | a);
+    return out;
+}
+
+static std::string
+base64(const std::string& in){
+
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+
+    for(std::size_t i = 0; i < in.size(); i += 3){
+        std::uint32_t n = static_cast<unsigned char>(in[i]) << 16;
+        if(i + 1 < in.size())
+            n |= static_cast<unsigned char>(in[i + 1]) << 8;
+        if(i + 2 < in.size())
+            n |= static_cast<unsigned char>(in[i + 2]);
+
+        out.push_back(alphabet[(n >> 18) & 63]);
+        out.push_back(alphabet[(n >> 12) & 63]);
+        out.push_back(i + 1 < in.size() ? alphabet[(n >> 6) & 63] : '=');
+        out.push_back(i + 2 < in.size() ? alphabet[n & 63] : '=');
+    }
+    return out;
+}
+
+// The compressed V2 encoding of HdrHistogram
+static std::string
+encode(const std::vector<std::uint64_t>& counts, std::uint64_t max){
+
+    std::string payload;
+    std::size_t last = hdr_counts::index(max);
+
+    for(std::size_t i = 0; i <= last;){
+        if(counts[i] != 0){
+            put_varint(payload, static_cast<std::int64_t>(counts[i++]));
+            continue;
+        }
+        std::int64_t zeros = 0;
+        while(i <= last && counts[i] == 0){
+            zeros++;
+            i++;
+        }
+        put_varint(payload, zeros > 1 ? -zeros : 0);
+    }
+
+    std::string encoded;
+    put32(encoded, 0x1c849313);
+    put32(encoded, payload.size());
+    put32(encoded, 0);                          // normalizing index offset
+    put32(encoded, 2);                          // significant digits
+    put64(encoded, 1);                          // lowest trackable value
+    put64(encoded, hdr_counts::highest);
+    put64(encoded, 0x3ff0000000000000ull);      // 1.0, the double ratio
+    encoded += payload;
+
+    std::string compressed = zlib_compress(encoded);
+    std::string out;
+    put32(out, 0x1c849314);
+    put32(out, compressed.size());
+    out += compressed;
+    return base64(out);
+}
+
+static std::atomic<std::uint64_t> next_recorder_id{1};
+
+latency_recorder::latency_recorder(std::size_t routes)
+    :routes_(routes),
+    id_(next_recorder_id++),
+    started_(std::chrono::system_clock::now())
+{
+}
+
+latency_recorder::thread_block::~thread_block(){
+    for(std::size_t i = 0; i < size; i++)
+        delete histograms[i].load(std::memory_order_relaxed);
+}
+
+latency_recorder::thread_block&
+latency_recorder::local(){
+
+    // a thread may outlive a recorder, blocks are found by recorder id
+    thread_local std::uint64_t cached_id = 0;
+    thread_local thread_block* cached = NULL;
+
+    if(cached_id == id_)
+        return *cached;
+
+    std::unique_ptr<thread_block> block(new thread_block);
+    block->size = routes_ * phases;
+    block->histograms.reset(new std::atomic<hdr_counts*>[block->size]);
+    for(std::size_t i = 0; i < block->size; i++)
+        block->histograms[i].store(NULL, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.push_back(std::move(block));
+    cached_id = id_;
+    cached = threads_.back().get();
+    return *cached;
+}
+
+void
+latency_recorder::record(std::size_t route, phase p, clock::duration d){
+
+    auto& slot = local().histograms[route * phases + p];
+    hdr_counts* counts = slot.load(std::memory_order_relaxed);
+
+    if(counts == NULL){
+        counts = new hdr_counts();
+        slot.store(counts, std::memory_order_release);
+    }
+
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    counts->record(us > 0 ? us : 0);
+}
+
+std::string
+latency_recorder::hdr_log(const std::vector<std::string>& route_names){
+
+    auto now = std::chrono::system_clock::now();
+    double start = std::chrono::duration<double>(started_.time_since_epoch()).count();
+    double length = std::chrono::duration<double>(now - started_).count();
+    char line[128];
+
+    std::string out = "#[Histogram log format version 1.3]\n";
+    std::snprintf(line, sizeof(line), "#[StartTime: %.3f (seconds since epoch)]\n", start);
+    out += line;
+    out += "\"StartTimestamp\",\"Interval_Length\",\"Interval_Max\",\"Interval_Compressed_Histogram\"\n";
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::uint64_t> counts(hdr_counts::length);
+
+    for(std::size_t route = 0; route < routes_; route++){
+        for(int p = 0; p < phases; p++){
+
+            std::fill(counts.begin(), counts.end(), 0);
+            std::uint64_t max = 0;
+            bool recorded = false;
+
+            for(auto& block : threads_){
+                hdr_counts* h = block->histograms[route * phases + p].load(std::memory_order_acquire);
+                if(h == NULL)
+                    continue;
+                recorded = true;
+                for(std::size_t i = 0; i < hdr_counts::length; i++)
+                    counts[i] += h->counts[i].load(std::memory_order_relaxed);
+                max = std::max(max, h->max.load(std::memory_order_relaxed));
+            }
+
+            if(!recorded)
+                continue;
+
+            std::snprintf(line, sizeof(line), ",0.000,%.3f,%.6f,", length, max / 1000000.0);
+            out += "Tag=" + route_names[route] + ":" + phase_names[p] + line + encode(counts, max) + "\n";
+        }
+    }
+
+    return out;
+}
+
+}
@@ -0,0 +1,97 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace httpserver {
+
+// Microsecond counts in the HdrHistogram bucket layout for values from 1us
+// to an hour at two significant digits, so the V2 encoding of the counts
+// is read by any HdrHistogram implementation
+struct hdr_counts {
+
+    static constexpr int sub_bucket_half_count_magnitude = 7;
+    static constexpr std::uint64_t sub_bucket_half_count = 128;
+    static constexpr std::uint64_t highest = 3600000000ull;
+    static constexpr std::size_t length = 26 * sub_bucket_half_count;
+
+    std::atomic<std::uint64_t> counts[length];
+    std::atomic<std::uint64_t> max;
+
+    static std::size_t
+    index(std::uint64_t value){
+        int bucket = 56 - __builtin_clzll(value | 255);
+        std::uint64_t sub_bucket = value >> bucket;
+        return ((bucket + 1) << sub_bucket_half_count_magnitude) + (sub_bucket - sub_bucket_half_count);
+    }
+
+    // only the owning thread records
+    void
+    record(std::uint64_t us){
+        us = us < highest ? us : highest;
+        auto& count = counts[index(us)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if(us > max.load(std::memory_order_relaxed))
+            max.store(us, std::memory_order_relaxed);
+    }
+};
+
+// Per-route latency of each phase of a request. Every thread records into
+// histograms of its own, allocated on its first request of a route, and
+// an export merges them.
+class latency_recorder {
+
+public:
+
+    using clock = std::chrono::steady_clock;
+
+    enum phase {
+        header,     // first byte to parsed header, beast parses as it reads
+        body,       // the rest of the request
+        convert,    // request_t built for the handler
+        queue,      // waiting for a worker, fiber or the route's bulkhead
+        handler,
+        serialize,  // response_t turned into the response header
+        write,
+        total,
+        phases
+    };
+
+    // routes slots, the last one for requests outside any route
+    explicit latency_recorder(std::size_t routes);
+
+    void
+    record(std::size_t route, phase p, clock::duration d);
+
+    // One HdrHistogram log interval line per route and phase with counts,
+    // tagged "<name>:<phase>", covering the time since the recorder started
+    std::string
+    hdr_log(const std::vector<std::string>& route_names);
+
+private:
+
+    struct thread_block {
+        std::unique_ptr<std::atomic<hdr_counts*>[]> histograms;
+        std::size_t size = 0;
+        ~thread_block();
+    };
+
+    thread_block&
+    local();
+
+    const std::size_t routes_;
+    const std::uint64_t id_;
+    const std::chrono::system_clock::time_point started_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<thread_block>> threads_;
+};
+
+}
+
+#endif // LATENCY_HISTOGRAM_H
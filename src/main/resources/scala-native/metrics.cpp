@@ -0,0 +1,37 @@
+
+#include "metrics.h"
+
+namespace httpserver {
+
+std::mutex metrics::mutex_;
+std::vector<std::unique_ptr<thread_metrics>> metrics::threads_;
+
+thread_metrics*
+metrics::add_thread(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.emplace_back(new thread_metrics);
+    return threads_.back().get();
+}
+
+metrics_snapshot
+metrics::sum(){
+
+    metrics_snapshot s;
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for(auto& t : threads_){
+        s.requests += t->requests.load(std::memory_order_relaxed);
+        s.bytes_in += t->bytes_in.load(std::memory_order_relaxed);
+        s.bytes_out += t->bytes_out.load(std::memory_order_relaxed);
+        for(int i = 0; i < 5; i++)
+            s.responses[i] += t->responses[i].load(std::memory_order_relaxed);
+        s.connections_opened += t->connections_opened.load(std::memory_order_relaxed);
+        s.connections_closed += t->connections_closed.load(std::memory_order_relaxed);
+        s.accept_errors += t->accept_errors.load(std::memory_order_relaxed);
+        s.timeouts += t->timeouts.load(std::memory_order_relaxed);
+    }
+
+    return s;
+}
+
+}
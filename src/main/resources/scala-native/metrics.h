@@ -0,0 +1,78 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace httpserver {
+
+// Counters of the thread that writes them. Every thread gets its own
+// cache-line aligned block, so the hot path does a plain load and store
+// without a locked instruction or a shared line; a scrape sums the blocks.
+struct alignas(64) thread_metrics {
+
+    std::atomic<std::uint64_t> requests{0};
+    std::atomic<std::uint64_t> bytes_in{0};
+    std::atomic<std::uint64_t> bytes_out{0};
+    // by status class, 1xx to 5xx
+    std::atomic<std::uint64_t> responses[5] = {};
+    std::atomic<std::uint64_t> connections_opened{0};
+    std::atomic<std::uint64_t> connections_closed{0};
+    std::atomic<std::uint64_t> accept_errors{0};
+    std::atomic<std::uint64_t> timeouts{0};
+
+    // only the owning thread writes
+    static void
+    add(std::atomic<std::uint64_t>& counter, std::uint64_t n = 1){
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void
+    response(unsigned int status){
+        if(status >= 100 && status < 600)
+            add(responses[status / 100 - 1]);
+    }
+};
+
+// The sum of every thread's counters
+struct metrics_snapshot {
+    std::uint64_t requests = 0;
+    std::uint64_t bytes_in = 0;
+    std::uint64_t bytes_out = 0;
+    std::uint64_t responses[5] = {};
+    std::uint64_t connections_opened = 0;
+    std::uint64_t connections_closed = 0;
+    std::uint64_t accept_errors = 0;
+    std::uint64_t timeouts = 0;
+};
+
+class metrics {
+
+public:
+
+    // The calling thread's counters, registered on first use. Blocks are
+    // never freed, a thread that exits keeps its counts in the sum.
+    static thread_metrics&
+    local(){
+        thread_local thread_metrics* counters = add_thread();
+        return *counters;
+    }
+
+    static metrics_snapshot
+    sum();
+
+private:
+
+    static thread_metrics*
+    add_thread();
+
+    static std::mutex mutex_;
+    static std::vector<std::unique_ptr<thread_metrics>> threads_;
+};
+
+}
+
+#endif // METRICS_H
@@ -0,0 +1,107 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace httpserver {
+
+// Bounded lock-free multi-producer multi-consumer queue (Vyukov). Every
+// cell carries a sequence number telling producers and consumers whose
+// turn it is, so push and pop are one CAS on their position each.
+// capacity is rounded up to a power of two.
+template <class T>
+class mpmc_queue {
+
+public:
+
+    explicit mpmc_queue(std::size_t capacity)
+        :mask_(round_up(capacity) - 1),
+         cells_(new cell[mask_ + 1])
+    {
+        for(std::size_t i = 0; i <= mask_; i++)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    mpmc_queue(const mpmc_queue&) = delete;
+    mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+    // false when the queue is full, value is left untouched then
+    bool
+    push(T& value){
+        std::size_t pos = enqueue_.load(std::memory_order_relaxed);
+        for(;;){
+            cell& c = cells_[pos & mask_];
+            std::size_t seq = c.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+            if(diff == 0){
+                if(enqueue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    c.value = std::move(value);
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0){
+                return false;
+            } else {
+                pos = enqueue_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // false when the queue is empty
+    bool
+    pop(T& value){
+        std::size_t pos = dequeue_.load(std::memory_order_relaxed);
+        for(;;){
+            cell& c = cells_[pos & mask_];
+            std::size_t seq = c.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+            if(diff == 0){
+                if(dequeue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    value = std::move(c.value);
+                    c.value = T();
+                    c.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0){
+                return false;
+            } else {
+                pos = dequeue_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // a snapshot, exact only while nobody pushes or pops
+    bool
+    empty() const {
+        return dequeue_.load(std::memory_order_acquire)
+            >= enqueue_.load(std::memory_order_acquire);
+    }
+
+private:
+
+    struct cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    static std::size_t
+    round_up(std::size_t n){
+        std::size_t size = 2;
+        while(size < n)
+            size <<= 1;
+        return size;
+    }
+
+    const std::size_t mask_;
+    std::unique_ptr<cell[]> cells_;
+    // producers and consumers each get their own cache line
+    alignas(64) std::atomic<std::size_t> enqueue_{0};
+    alignas(64) std::atomic<std::size_t> dequeue_{0};
+};
+
+}
+
+#endif // MPMC_QUEUE_H
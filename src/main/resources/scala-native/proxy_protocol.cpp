@@ -0,0 +1,161 @@
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+
+#include "proxy_protocol.h"
+
+namespace httpserver {
+namespace proxy_protocol {
+
+namespace {
+
+const char v1_prefix[] = "PROXY ";
+const std::size_t v1_max = 107;
+
+const unsigned char v2_signature[12] = {
+    0x0D, 0x0A, 0x0D, 0x0A, 0x00, 0x0D, 0x0A, 0x51, 0x55, 0x49, 0x54, 0x0A };
+const std::size_t v2_fixed = 16;
+
+bool
+parse_port(const std::string& text, unsigned short& port){
+    if(text.empty() || text.size() > 5 || text.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    unsigned long value = std::strtoul(text.c_str(), NULL, 10);
+    if(value > 65535)
+        return false;
+    port = static_cast<unsigned short>(value);
+    return true;
+}
+
+bool
+parse_address(int family, const std::string& text, const std::string& port, address_t& address){
+    address.family = family;
+    return inet_pton(family, text.c_str(), address.addr) == 1
+        && parse_port(port, address.port);
+}
+
+// PROXY TCP4|TCP6 <src> <dst> <sport> <dport>\r\n or PROXY UNKNOWN ...\r\n
+int
+parse_v1(const char* data, std::size_t size, header& result){
+
+    std::size_t prefix = sizeof(v1_prefix) - 1;
+    if(std::memcmp(data, v1_prefix, std::min(size, prefix)) != 0)
+        return -1;
+
+    const char* end = static_cast<const char*>(
+        memmem(data, std::min(size, v1_max), "\r\n", 2));
+    if(end == NULL)
+        return size < v1_max ? 0 : -1;
+
+    std::string fields[6];
+    int count = 0;
+    for(const char* p = data; p < end; p++){
+        if(*p == ' '){
+            if(++count == 6)
+                return -1;
+        } else {
+            fields[count] += *p;
+        }
+    }
+
+    int length = static_cast<int>(end - data) + 2;
+
+    if(fields[1] == "UNKNOWN"){
+        result.local = true;
+        return length;
+    }
+
+    int family;
+    if(fields[1] == "TCP4")
+        family = AF_INET;
+    else if(fields[1] == "TCP6")
+        family = AF_INET6;
+    else
+        return -1;
+
+    if(count != 5
+       || !parse_address(family, fields[2], fields[4], result.source)
+       || !parse_address(family, fields[3], fields[5], result.destination))
+        return -1;
+
+    result.local = false;
+    return length;
+}
+
+int
+parse_v2(const unsigned char* data, std::size_t size, header& result){
+
+    if(size < v2_fixed)
+        return 0;
+
+    unsigned char version = data[12] >> 4;
+    unsigned char command = data[12] & 0x0F;
+    unsigned char family = data[13] >> 4;
+    std::size_t length = (std::size_t(data[14]) << 8) | data[15];
+
+    if(version != 2 || command > 1)
+        return -1;
+
+    if(size < v2_fixed + length)
+        return 0;
+
+    const unsigned char* addr = data + v2_fixed;
+
+    // LOCAL is a health check of the proxy itself, TLVs after the
+    // addresses are skipped
+    result.local = command == 0;
+    if(!result.local){
+        switch(family){
+        case 1: // AF_INET
+            if(length < 12)
+                return -1;
+            result.source.family = result.destination.family = AF_INET;
+            std::memcpy(result.source.addr, addr, 4);
+            std::memcpy(result.destination.addr, addr + 4, 4);
+            result.source.port = (addr[8] << 8) | addr[9];
+            result.destination.port = (addr[10] << 8) | addr[11];
+            break;
+        case 2: // AF_INET6
+            if(length < 36)
+                return -1;
+            result.source.family = result.destination.family = AF_INET6;
+            std::memcpy(result.source.addr, addr, 16);
+            std::memcpy(result.destination.addr, addr + 16, 16);
+            result.source.port = (addr[32] << 8) | addr[33];
+            result.destination.port = (addr[34] << 8) | addr[35];
+            break;
+        case 3: // AF_UNIX, the paths are not kept
+            result.source.family = result.destination.family = AF_UNIX;
+            break;
+        default:
+            result.local = true;
+        }
+    }
+
+    return static_cast<int>(v2_fixed + length);
+}
+
+}
+
+int
+parse(const char* data, std::size_t size, header& result){
+
+    if(size == 0)
+        return 0;
+
+    if(data[0] == 'P')
+        return parse_v1(data, size, result);
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    if(std::memcmp(bytes, v2_signature, std::min(size, sizeof(v2_signature))) != 0)
+        return -1;
+
+    return parse_v2(bytes, size, result);
+}
+
+}
+}
@@ -0,0 +1,30 @@
+#ifndef PROXY_PROTOCOL_H
+#define PROXY_PROTOCOL_H
+
+#include <cstddef>
+
+#include "beast_server.h"
+
+namespace httpserver {
+
+// The PROXY protocol header (v1 text or v2 binary) a load balancer sends
+// ahead of the proxied stream to pass on the original addresses.
+namespace proxy_protocol {
+
+struct header {
+    // LOCAL/UNKNOWN, the connection's own addresses apply
+    bool local = true;
+    address_t source = {};
+    address_t destination = {};
+};
+
+// parses a header from the front of data, returns its length, 0 when more
+// data is needed, or -1 when data does not start with a valid header
+int
+parse(const char* data, std::size_t size, header& result);
+
+}
+
+}
+
+#endif // PROXY_PROTOCOL_H
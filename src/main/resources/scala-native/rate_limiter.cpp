@@ -0,0 +1,105 @@
+
+#include <algorithm>
+
+#include "rate_limiter.h"
+
+namespace httpserver {
+
+static constexpr std::uint64_t token = 256;
+static constexpr std::uint64_t token_bits = 24;
+
+static std::uint64_t
+hash_key(const void* key, std::size_t size){
+
+    // FNV-1a, 0 marks a free bucket
+    const unsigned char* bytes = static_cast<const unsigned char*>(key);
+    std::uint64_t hash = 14695981039346656037ull;
+    for(std::size_t i = 0; i < size; i++){
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+rate_limiter::rate_limiter(unsigned int rate, unsigned int burst, std::size_t capacity)
+    :rate_(rate),
+    burst_(std::min<std::uint64_t>(std::max(burst, rate > 0 ? 1u : 0u), (1 << token_bits) / token - 1)),
+    started_(std::chrono::steady_clock::now())
+{
+    std::size_t per_shard = 1;
+    while(per_shard * shards < capacity || per_shard < probes)
+        per_shard <<= 1;
+    shard_mask_ = per_shard - 1;
+
+    for(auto& shard : shards_)
+        shard.reset(new bucket[per_shard]);
+}
+
+std::uint64_t
+rate_limiter::now_ms(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started_).count() + 1;
+}
+
+rate_limiter::bucket&
+rate_limiter::find(std::uint64_t hash){
+
+    bucket* shard = shards_[hash >> 58].get();
+    std::size_t first = hash & shard_mask_;
+    bucket* oldest = NULL;
+    std::uint64_t oldest_time = ~0ull;
+
+    for(std::size_t i = 0; i < probes; i++){
+        bucket& b = shard[(first + i) & shard_mask_];
+        std::uint64_t key = b.key.load(std::memory_order_acquire);
+
+        if(key == hash)
+            return b;
+
+        if(key == 0 && b.key.compare_exchange_strong(key, hash, std::memory_order_acq_rel))
+            return b;
+
+        // claimed by a concurrent first request of the same client
+        if(key == hash)
+            return b;
+
+        std::uint64_t time = b.state.load(std::memory_order_relaxed) >> token_bits;
+        if(time < oldest_time){
+            oldest = &b;
+            oldest_time = time;
+        }
+    }
+
+    // the window is full, the bucket used longest ago starts over
+    std::uint64_t key = oldest->key.load(std::memory_order_relaxed);
+    if(oldest->key.compare_exchange_strong(key, hash, std::memory_order_acq_rel))
+        oldest->state.store(0, std::memory_order_release);
+    return *oldest;
+}
+
+std::uint64_t
+rate_limiter::acquire(const void* key, std::size_t size){
+
+    std::uint64_t hash = hash_key(key, size);
+    std::uint64_t now = now_ms();
+    bucket& b = find(hash);
+
+    std::uint64_t state = b.state.load(std::memory_order_acquire);
+    for(;;){
+        std::uint64_t tokens = burst_ * token;
+        if(state != 0){
+            std::uint64_t then = state >> token_bits;
+            std::uint64_t elapsed = now > then ? now - then : 0;
+            tokens = std::min(tokens, (state & ((1 << token_bits) - 1)) + elapsed * rate_ * token / 1000);
+        }
+
+        if(tokens < token)
+            return rate_ > 0 ? ((token - tokens) * 1000 + rate_ * token - 1) / (rate_ * token) : 1000;
+
+        std::uint64_t next = (now << token_bits) | (tokens - token);
+        if(b.state.compare_exchange_weak(state, next, std::memory_order_acq_rel))
+            return 0;
+    }
+}
+
+}
@@ -0,0 +1,61 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace httpserver {
+
+// Token buckets per client, refilled at rate tokens a second up to burst.
+//
+// Buckets live in an open-addressing table split into shards by the high
+// bits of the key's hash. A bucket is two atomic words, the key hash and
+// its state (last refill in milliseconds and tokens in 1/256ths), updated
+// with CAS only: no lock is taken on the request path. A full probe window
+// evicts its least recently used bucket, so a flood of new keys costs old
+// clients their history rather than memory.
+class rate_limiter {
+
+public:
+
+    rate_limiter(unsigned int rate, unsigned int burst, std::size_t capacity);
+
+    rate_limiter(const rate_limiter&) = delete;
+    rate_limiter& operator=(const rate_limiter&) = delete;
+
+    // Takes a token from the bucket of key, returns 0 or, when it is empty,
+    // the milliseconds until the next one
+    std::uint64_t
+    acquire(const void* key, std::size_t size);
+
+private:
+
+    struct alignas(16) bucket {
+        std::atomic<std::uint64_t> key{0};
+        // refill time + 1 in the high 40 bits, tokens in the low 24, 0 for
+        // a bucket just claimed
+        std::atomic<std::uint64_t> state{0};
+    };
+
+    static constexpr std::size_t shards = 64;
+    static constexpr std::size_t probes = 8;
+
+    bucket&
+    find(std::uint64_t hash);
+
+    std::uint64_t
+    now_ms();
+
+    const std::uint64_t rate_;
+    const std::uint64_t burst_;
+    const std::chrono::steady_clock::time_point started_;
+    std::size_t shard_mask_;
+    std::unique_ptr<bucket[]> shards_[shards];
+};
+
+}
+
+#endif // RATE_LIMITER_H
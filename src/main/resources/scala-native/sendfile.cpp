@@ -0,0 +1,27 @@
+
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include "sendfile.h"
+
+namespace httpserver {
+namespace sendfile {
+
+ssize_t
+send(int socket_fd, int in_fd, std::size_t offset, std::size_t size){
+#ifdef __linux__
+    off_t off = static_cast<off_t>(offset);
+    return ::sendfile(socket_fd, in_fd, &off, size);
+#else
+    (void) socket_fd; (void) in_fd; (void) offset; (void) size;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+}
+}
@@ -0,0 +1,20 @@
+#ifndef SENDFILE_H
+#define SENDFILE_H
+
+#include <cstddef>
+#include <sys/types.h>
+
+namespace httpserver {
+
+namespace sendfile {
+
+// copies up to size bytes of in_fd starting at offset to the socket inside
+// the kernel, returns -1 and sets errno like sendfile(2)
+ssize_t
+send(int socket_fd, int in_fd, std::size_t offset, std::size_t size);
+
+}
+
+}
+
+#endif // SENDFILE_H
@@ -0,0 +1,84 @@
+
+#include <cstdio>
+
+#include "slow_requests.h"
+
+namespace httpserver {
+
+slow_requests::slow_requests(unsigned int threshold_ms, std::size_t kept)
+    :threshold_(std::chrono::milliseconds(threshold_ms))
+{
+    requests_.reserve(kept > 0 ? kept : 1);
+}
+
+void
+slow_requests::add(const slow_request& request){
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if(requests_.size() < requests_.capacity())
+        requests_.push_back(request);
+    else
+        requests_[next_] = request;
+
+    next_ = (next_ + 1) % requests_.capacity();
+    captured_++;
+}
+
+std::uint64_t
+slow_requests::captured(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    return captured_;
+}
+
+std::string
+slow_requests::text(){
+
+    std::vector<slow_request> requests;
+    std::size_t first;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requests = requests_;
+        first = requests_.size() < requests_.capacity() ? 0 : next_;
+    }
+
+    std::string out;
+    char line[512];
+
+    for(std::size_t i = 0; i < requests.size(); i++){
+        const slow_request& r = requests[(first + i) % requests.size()];
+        const access_record& a = r.request;
+
+        char client[64];
+        if(address_format(&a.client, client, sizeof(client)) < 0)
+            client[0] = '\0';
+
+        auto verb = boost::beast::http::to_string(a.verb);
+        std::snprintf(line, sizeof(line), "{\"time_us\":%lld,\"client\":\"%s\",\"verb\":\"%.*s\",\"target\":\"",
+                      static_cast<long long>(a.time_us), client,
+                      static_cast<int>(verb.size()), verb.data());
+        out += line;
+
+        append_json_escaped(out, a.target, a.target_size);
+
+        std::snprintf(line, sizeof(line),
+                      "\",\"status\":%u,\"bytes_in\":%llu,\"bytes_out\":%llu,\"total_us\":%u,"
+                      "\"header_us\":%u,\"body_us\":%u,\"convert_us\":%u,\"queue_us\":%u,"
+                      "\"handler_us\":%u,\"serialize_us\":%u,\"write_us\":%u,"
+                      "\"connection_age_ms\":%llu,\"connection_requests\":%llu,\"thread\":%ld}\n",
+                      a.status,
+                      static_cast<unsigned long long>(a.bytes_in),
+                      static_cast<unsigned long long>(a.bytes_out),
+                      a.duration_us,
+                      r.header_us, r.body_us, r.convert_us, r.queue_us,
+                      r.handler_us, r.serialize_us, r.write_us,
+                      static_cast<unsigned long long>(r.connection_age_ms),
+                      static_cast<unsigned long long>(r.connection_requests),
+                      r.thread);
+        out += line;
+    }
+
+    return out;
+}
+
+}
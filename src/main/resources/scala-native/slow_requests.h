@@ -0,0 +1,63 @@
+#ifndef SLOW_REQUESTS_H
+#define SLOW_REQUESTS_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "access_log.h"
+
+namespace httpserver {
+
+struct slow_request {
+    access_record request;
+    // microseconds spent in each phase, 0 for phases the request skipped
+    std::uint32_t header_us;
+    std::uint32_t body_us;
+    std::uint32_t convert_us;
+    std::uint32_t queue_us;
+    std::uint32_t handler_us;
+    std::uint32_t serialize_us;
+    std::uint32_t write_us;
+    std::uint64_t connection_age_ms;
+    std::uint64_t connection_requests;
+    long thread;                    // of the io thread that wrote the response
+};
+
+// The last kept requests that took threshold or longer, kept by value in
+// a ring under a mutex; only slow requests ever take it
+class slow_requests {
+
+public:
+
+    slow_requests(unsigned int threshold_ms, std::size_t kept);
+
+    std::chrono::steady_clock::duration
+    threshold() const {
+        return threshold_;
+    }
+
+    void
+    add(const slow_request& request);
+
+    // One JSON line a request, oldest first
+    std::string
+    text();
+
+    std::uint64_t
+    captured();
+
+private:
+
+    const std::chrono::steady_clock::duration threshold_;
+    std::mutex mutex_;
+    std::vector<slow_request> requests_;
+    std::size_t next_ = 0;
+    std::uint64_t captured_ = 0;
+};
+
+}
+
+#endif // SLOW_REQUESTS_H
@@ -0,0 +1,135 @@
+
+#include "timer_wheel.h"
+
+namespace httpserver {
+
+timer_wheel::timer_wheel(
+    net::io_context& io,
+    std::chrono::milliseconds tick,
+    std::size_t slots)
+    :timer_(net::make_strand(io)),
+     tick_duration_(tick),
+     start_(std::chrono::steady_clock::now()),
+     slots_(slots, nullptr)
+{
+}
+
+void
+timer_wheel::start(){
+    do_tick();
+}
+
+void
+timer_wheel::stop(){
+    // the pending tick sees this and does not re-arm
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+}
+
+std::uint64_t
+timer_wheel::schedule(timer_wheel_entry* entry, std::chrono::steady_clock::time_point deadline){
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - start_);
+
+    // round up, a deadline never fires early
+    std::uint64_t tick = elapsed.count() <= 0
+        ? 0
+        : (elapsed.count() + tick_duration_.count() - 1) / tick_duration_.count();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if(entry->linked_)
+        unlink(entry);
+
+    // already due, fire on the next tick
+    if(tick <= current_)
+        tick = current_ + 1;
+
+    timer_wheel_entry*& head = slots_[tick % slots_.size()];
+    entry->tick_ = tick;
+    entry->prev_ = nullptr;
+    entry->next_ = head;
+    if(head != nullptr)
+        head->prev_ = entry;
+    head = entry;
+    entry->linked_ = true;
+
+    return ++entry->generation_;
+}
+
+void
+timer_wheel::cancel(timer_wheel_entry* entry){
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(entry->linked_)
+        unlink(entry);
+    entry->generation_++;
+}
+
+void
+timer_wheel::unlink(timer_wheel_entry* entry){
+    if(entry->prev_ != nullptr)
+        entry->prev_->next_ = entry->next_;
+    else
+        slots_[entry->tick_ % slots_.size()] = entry->next_;
+
+    if(entry->next_ != nullptr)
+        entry->next_->prev_ = entry->prev_;
+
+    entry->prev_ = nullptr;
+    entry->next_ = nullptr;
+    entry->linked_ = false;
+}
+
+void
+timer_wheel::do_tick(){
+    // absolute tick times, a slow tick does not shift the ones after it
+    timer_.expires_at(start_ + tick_duration_ * (current_ + 1));
+    timer_.async_wait(
+        [this](const boost::system::error_code& ec) {
+            on_tick(ec);
+        });
+}
+
+void
+timer_wheel::on_tick(const boost::system::error_code& ec){
+
+    std::vector<std::pair<std::shared_ptr<timer_wheel_entry>, std::uint64_t>> expired;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if(ec || stopped_)
+            return;
+
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start_).count() / tick_duration_.count();
+
+        // catch up on ticks missed while the io threads were busy
+        while(current_ < static_cast<std::uint64_t>(now)){
+            current_++;
+
+            timer_wheel_entry* entry = slots_[current_ % slots_.size()];
+            while(entry != nullptr){
+                timer_wheel_entry* next = entry->next_;
+                if(entry->tick_ <= current_){
+                    unlink(entry);
+                    // empty while the owner is in its destructor, which
+                    // waits on our lock to cancel
+                    auto ref = entry->timeout_ref();
+                    if(ref)
+                        expired.push_back({ref, entry->generation_});
+                }
+                entry = next;
+            }
+        }
+    }
+
+    for(auto& e : expired)
+        e.first->on_timeout(e.second);
+
+    // release the refs, possibly running destructors, before re-arming
+    expired.clear();
+
+    do_tick();
+}
+
+}
@@ -0,0 +1,93 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace httpserver {
+
+namespace net = boost::asio;
+
+// An object with a deadline on a timer_wheel, linked into the wheel slot
+// of its deadline so scheduling and cancelling are O(1)
+class timer_wheel_entry {
+
+public:
+
+    virtual ~timer_wheel_entry() {}
+
+    // Called without the wheel lock on the wheel's tick. generation is the
+    // schedule() that expired, compare it to drop a deadline that was
+    // replaced while this call was in flight.
+    virtual void on_timeout(std::uint64_t generation) = 0;
+
+    // Keeps the owner alive while on_timeout runs, empty if it is being
+    // destroyed
+    virtual std::shared_ptr<timer_wheel_entry> timeout_ref() = 0;
+
+private:
+    friend class timer_wheel;
+
+    timer_wheel_entry* prev_ = nullptr;
+    timer_wheel_entry* next_ = nullptr;
+    std::uint64_t tick_ = 0;
+    std::uint64_t generation_ = 0;
+    bool linked_ = false;
+};
+
+// Hashed timer wheel: one steady_timer ticks every `tick` and expires the
+// entries of the current slot, deadlines more than a revolution away stay
+// linked until their tick comes around. The server keeps a few wheels and
+// spreads sessions over them so the lock is not shared by every thread.
+class timer_wheel {
+
+public:
+
+    timer_wheel(net::io_context& io,
+                std::chrono::milliseconds tick,
+                std::size_t slots);
+
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+
+    void
+    start();
+
+    void
+    stop();
+
+    // (re)schedules entry, returns the generation passed to on_timeout
+    std::uint64_t
+    schedule(timer_wheel_entry* entry, std::chrono::steady_clock::time_point deadline);
+
+    void
+    cancel(timer_wheel_entry* entry);
+
+private:
+
+    void
+    do_tick();
+
+    void
+    on_tick(const boost::system::error_code& ec);
+
+    void
+    unlink(timer_wheel_entry* entry);
+
+    net::steady_timer timer_;
+    std::chrono::milliseconds tick_duration_;
+    std::chrono::steady_clock::time_point start_;
+    std::mutex mutex_;
+    std::vector<timer_wheel_entry*> slots_;
+    std::uint64_t current_ = 0;
+    bool stopped_ = false;
+};
+
+}
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,94 @@
+
+#include "worker_pool.h"
+
+namespace httpserver {
+
+worker_pool::worker_pool(std::size_t threads, std::size_t queue_size)
+{
+    for(auto& queue : queues_)
+        queue.reset(new mpmc_queue<std::function<void()>>(queue_size));
+
+    threads_.reserve(threads);
+    for(std::size_t i = 0; i < threads; i++)
+        threads_.emplace_back([this]{ work(); });
+}
+
+worker_pool::~worker_pool(){
+    stop();
+}
+
+bool
+worker_pool::post(std::function<void()> job, int priority){
+
+    auto& queue = priority == PRIORITY_HIGH ? queues_[0]
+        : priority == PRIORITY_LOW ? queues_[2]
+        : queues_[1];
+
+    if(!queue->push(job))
+        return false;
+
+    // pairs with the fence in work(), either the worker going to sleep
+    // sees the job or we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleeping_.load(std::memory_order_relaxed) > 0){
+        std::lock_guard<std::mutex> lock(mutex_);
+        wakeup_.notify_one();
+    }
+    return true;
+}
+
+void
+worker_pool::stop(){
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    wakeup_.notify_all();
+
+    for(auto& thread : threads_)
+        if(thread.joinable())
+            thread.join();
+}
+
+void
+worker_pool::work(){
+
+    std::function<void()> job;
+    unsigned int turn = 0;
+
+    for(;;){
+        if(pop(job, turn++)){
+            job();
+            job = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if(stopped_)
+            return;
+
+        sleeping_++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wakeup_.wait(lock, [this]{ return stopped_ || !empty(); });
+        sleeping_--;
+    }
+}
+
+bool
+worker_pool::pop(std::function<void()>& job, unsigned int turn){
+
+    if(queues_[0]->pop(job))
+        return true;
+
+    if(turn % 5 == 4)
+        return queues_[2]->pop(job) || queues_[1]->pop(job);
+
+    return queues_[1]->pop(job) || queues_[2]->pop(job);
+}
+
+bool
+worker_pool::empty(){
+    return queues_[0]->empty() && queues_[1]->empty() && queues_[2]->empty();
+}
+
+}
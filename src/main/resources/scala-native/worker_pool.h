@@ -0,0 +1,66 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "beast_server.h"
+#include "mpmc_queue.h"
+
+namespace httpserver {
+
+// Threads running blocking handlers off the io threads. Jobs go through
+// bounded lock-free queues, a worker only takes the mutex to sleep when it
+// finds them empty and a producer only to wake a sleeping worker.
+//
+// There is one queue per priority class. High priority jobs always run
+// first, normal ones get four turns for each low one so a flood of either
+// cannot starve the other.
+class worker_pool {
+
+public:
+
+    worker_pool(std::size_t threads, std::size_t queue_size);
+
+    ~worker_pool();
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    // false when the queue is full, the caller answers the request itself;
+    // priority is a PRIORITY_ class
+    bool
+    post(std::function<void()> job, int priority);
+
+    // runs the jobs still queued and joins the threads
+    void
+    stop();
+
+private:
+
+    void
+    work();
+
+    bool
+    pop(std::function<void()>& job, unsigned int turn);
+
+    bool
+    empty();
+
+    // high, normal and low
+    std::unique_ptr<mpmc_queue<std::function<void()>>> queues_[3];
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::atomic<std::size_t> sleeping_{0};
+    std::atomic<bool> stopped_{false};
+};
+
+}
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,79 @@
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#endif
+
+#include "zerocopy.h"
+
+namespace httpserver {
+namespace zerocopy {
+
+bool
+enable(int fd){
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int one = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#else
+    (void) fd;
+    return false;
+#endif
+}
+
+ssize_t
+send(int fd, const char* data, std::size_t size){
+#if defined(MSG_ZEROCOPY)
+    return ::send(fd, data, size, MSG_ZEROCOPY | MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+    (void) fd; (void) data; (void) size;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+bool
+read_completions(int fd, std::uint32_t& completed){
+#if defined(MSG_ZEROCOPY)
+    for(;;){
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if(recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+        for(cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)){
+
+            bool recverr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+            if(!recverr)
+                continue;
+
+            sock_extended_err serr;
+            memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+
+            if(serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            // [ee_info, ee_data] is the inclusive range of finished ids;
+            // SO_EE_CODE_ZEROCOPY_COPIED only means the kernel fell back
+            // to copying, the buffers are released all the same
+            std::uint32_t next = serr.ee_data + 1;
+            if(static_cast<std::int32_t>(next - completed) > 0)
+                completed = next;
+        }
+    }
+#else
+    (void) fd; (void) completed;
+    return true;
+#endif
+}
+
+}
+}
@@ -0,0 +1,32 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace httpserver {
+
+// Thin wrappers over SO_ZEROCOPY/MSG_ZEROCOPY (Linux >= 4.14). Every
+// successful zerocopy send gets the next 32 bit id on that socket; the
+// kernel reports finished ids as ranges on the socket error queue.
+namespace zerocopy {
+
+// enables SO_ZEROCOPY on the socket, false if the platform lacks it
+bool
+enable(int fd);
+
+// non-blocking send with MSG_ZEROCOPY, returns -1 and sets errno like send(2)
+ssize_t
+send(int fd, const char* data, std::size_t size);
+
+// drains the error queue, raising completed to one past the highest
+// finished id, returns false on a real socket error
+bool
+read_completions(int fd, std::uint32_t& completed);
+
+}
+
+}
+
+#endif // ZEROCOPY_H
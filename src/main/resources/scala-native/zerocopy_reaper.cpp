@@ -0,0 +1,81 @@
+
+#include "zerocopy.h"
+#include "zerocopy_reaper.h"
+
+namespace httpserver {
+
+void
+zerocopy_reaper::start(stream_protocol::socket&& socket,
+                       std::uint32_t completed,
+                       zerocopy_pending&& pending){
+
+    auto reaper = std::make_shared<zerocopy_reaper>(
+        std::move(socket), completed, std::move(pending));
+
+    // the peer still gets the unsent data, then end of stream
+    beast::error_code ec;
+    reaper->socket_.shutdown(stream_protocol::socket::shutdown_both, ec);
+
+    net::dispatch(
+        reaper->socket_.get_executor(),
+        beast::bind_front_handler(&zerocopy_reaper::reap, reaper));
+}
+
+zerocopy_reaper::zerocopy_reaper(stream_protocol::socket&& socket,
+                                 std::uint32_t completed,
+                                 zerocopy_pending&& pending)
+    :socket_(std::move(socket)),
+    timer_(socket_.get_executor()),
+    completed_(completed),
+    pending_(std::move(pending))
+{
+}
+
+void
+zerocopy_reaper::reap(){
+
+    // recvmsg on the error queue only fails on a bad socket, nothing
+    // tells then when the kernel is done, the bodies are leaked
+    if(!zerocopy::read_completions(socket_.native_handle(), completed_))
+        pending_.clear();
+
+    while(!pending_.empty()
+          && static_cast<std::int32_t>(completed_ - pending_.front().first) >= 0){
+        body_t* body = pending_.front().second;
+        if(body != NULL && body->release != NULL)
+            body->release(body->body_raw, body->size);
+        pending_.pop_front();
+    }
+
+    // the waits hold the reaper, ending them closes the socket
+    if(pending_.empty()){
+        beast::error_code ec;
+        socket_.cancel(ec);
+        timer_.cancel();
+        return;
+    }
+
+    if(!waiting_){
+        waiting_ = true;
+        socket_.async_wait(
+            stream_protocol::socket::wait_error,
+            [self = shared_from_this()](beast::error_code ec) {
+                self->waiting_ = false;
+                if(ec != net::error::operation_aborted)
+                    self->reap();
+            });
+    }
+
+    if(!timing_){
+        timing_ = true;
+        timer_.expires_after(recheck_interval);
+        timer_.async_wait(
+            [self = shared_from_this()](beast::error_code ec) {
+                self->timing_ = false;
+                if(ec != net::error::operation_aborted)
+                    self->reap();
+            });
+    }
+}
+
+}
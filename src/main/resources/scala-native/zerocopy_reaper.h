@@ -0,0 +1,59 @@
+#ifndef ZEROCOPY_REAPER_H
+#define ZEROCOPY_REAPER_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <utility>
+
+#include "httpserver.h"
+
+namespace httpserver {
+
+// Bodies sent with MSG_ZEROCOPY, each with the id after its last send
+using zerocopy_pending = std::deque<std::pair<std::uint32_t, body_t*>>;
+
+// Keeps the socket of a finished session until the kernel is done with
+// its zerocopy bodies. Closing the socket does not unpin their pages,
+// only the completions on its error queue tell when a body may be
+// released. The connection is shut down, the reaper only reads the
+// error queue, and closes the socket after the last completion.
+class zerocopy_reaper : public std::enable_shared_from_this<zerocopy_reaper> {
+
+public:
+
+    // takes socket, completed is one past the last id already completed
+    static void
+    start(stream_protocol::socket&& socket,
+          std::uint32_t completed,
+          zerocopy_pending&& pending);
+
+    zerocopy_reaper(stream_protocol::socket&& socket,
+                    std::uint32_t completed,
+                    zerocopy_pending&& pending);
+
+    // Bodies still pending when the io_context goes away are leaked, the
+    // kernel may still read them
+    ~zerocopy_reaper() = default;
+
+private:
+
+    void
+    reap();
+
+    // completions surface as EPOLLERR, the timer covers a notification
+    // that came before the wait was queued
+    static constexpr std::chrono::seconds recheck_interval{1};
+
+    stream_protocol::socket socket_;
+    net::steady_timer timer_;
+    std::uint32_t completed_;
+    zerocopy_pending pending_;
+    bool waiting_ = false;
+    bool timing_ = false;
+};
+
+}
+
+#endif // ZEROCOPY_REAPER_H
@@ -20,8 +20,8 @@ object beast_server:
   type BeastHeaders = CStruct2[BeastHeaderPtr, CInt]
   type BeastHeadersPtr = Ptr[BeastHeaders]
 
-  // body {str, body raw, int}
-  type BeastBody = CStruct3[CString, Ptr[Byte], CInt]
+  // body {str, body raw, int, release callback, fd, fd offset}
+  type BeastBody = CStruct6[CString, Ptr[Byte], CInt, Ptr[Byte], CInt, CLong]
   type BeastBodyPtr = Ptr[BeastBody]
 
   // verb, target, content type, {body str, body bytes, size} , {[{name, value], size}
@@ -170,6 +170,8 @@ object beast:
 
         val body = unsafe.stackalloc[BeastBody]()
         body._3 = response.bodySize
+        // not a file body, fd 0 is a valid descriptor
+        body._5 = -1
 
         if response.hasBodyStr then
           body._1 = unsafe.toCString(response.body.get)